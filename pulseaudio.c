@@ -71,6 +71,14 @@ void write_audio (void *bla, int *in, int size) {
 	}	
 }
 
+/* writes the buffered samples without waiting for them to be played, so
+ * the stream can be continued gaplessly (continuous mode) */
+void flush_audio (void *s) {
+	int e;
+	pa_simple_write(s, buf, bufpos*sizeof(short int), &e);
+	bufpos = 0;
+}
+
 void close_audio (void *s) {
 	int e;
 	pa_simple_write(s, buf, bufpos*sizeof(short int), &e);
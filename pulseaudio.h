@@ -23,6 +23,7 @@ Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 void *open_dsp (); 
 void write_audio (void *bla, int *in, int size);
+void flush_audio (void *s);
 void close_audio (void *s);
 
 #endif
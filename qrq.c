@@ -39,8 +39,17 @@ Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <sys/stat.h>			/* mkdir */
 #include <sys/types.h>
 #include <errno.h>
+#include <stdint.h>
 #ifdef WIN32
 #include <windows.h>
+#else
+#include <sys/mman.h>			/* mmap for .qcbx callbases */
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>		/* toplist changes by other programs */
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
 #endif
 
 #define PI M_PI
@@ -60,6 +69,7 @@ Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 #ifdef CA
 #include "coreaudio.h"
+#define flush_audio(x)
 typedef void *AUDIO_HANDLE;
 #endif
 
@@ -67,6 +77,7 @@ typedef void *AUDIO_HANDLE;
 #include "oss.h"
 #define write_audio(x, y, z) write(x, y, z)
 #define close_audio(x) close(x)
+#define flush_audio(x)
 typedef int AUDIO_HANDLE;
 #endif
 
@@ -75,8 +86,161 @@ typedef int AUDIO_HANDLE;
 typedef void *AUDIO_HANDLE;
 #endif
 
-/* callsign array will be dynamically allocated */
-static char **calls = NULL;
+/* the callbase: all calls as NUL-terminated strings in one arena, found
+ * by their offset in cboffs. */
+static char *cbarena = NULL;
+static uint32_t *cboffs = NULL;
+static uint32_t *cbperm = NULL;			/* permutation of all calls ... */
+static uint32_t cbpos = 0;				/* ... the first cbpos are used */
+static uint32_t *cbinv = NULL;			/* position of every call in cbperm */
+static unsigned long cbgen = 0;			/* incremented at every (re)load */
+#define CBMAXLEN 79						/* longer entries are cut */
+
+/* large callbases are kept front coded instead: in blocks of FCBLOCK
+ * calls, the first one is stored in full, every other one as the number of
+ * leading characters it shares with its predecessor plus the rest. fcblocks
+ * has the offset of every block in fcdata. Sorted lists shrink a lot. */
+#define FCBLOCK 16
+#define FCTHRESHOLD (1 << 20)			/* for files larger than 1 MB */
+static unsigned char *fcdata = NULL;
+static uint32_t *fcblocks = NULL;
+
+/* streaming callbase: instead of loading the file, every attempt draws a
+ * sample of the calls in one pass (reservoir sampling). cbline has the
+ * line number of every sampled call, cbtotal is the number of calls in
+ * the file, nrofcalls the number in memory. The sample the background
+ * loader drew is used for the next attempt, unless a fixed seed has to
+ * decide the calls. */
+static int streamcallbase = 0;
+#define CBWINDOW 1000					/* sample for unlimited attempts */
+static uint32_t *cbline = NULL;
+static unsigned long cbtotal = 0;
+static int cbsample = 0;				/* size of the last sample */
+static int cbfresh = 0;					/* loader's sample not used yet */
+
+/* call filter, e.g. "JA*,4-6" or "*?/P,*?/MM": globs (one of them has to
+ * match) and a length range. It is applied to an index made once per
+ * callbase: all calls sorted (for prefixes) and grouped by length. The
+ * matching calls are the first cbactive entries of cbperm. */
+#define FILTERLEN 40
+static char cbfilter[FILTERLEN+1] = "";
+static uint32_t *cbsorted = NULL;		/* indices, sorted by call */
+static uint32_t *cblenidx = NULL;		/* indices, sorted by length */
+static uint32_t cblenstart[CBMAXLEN+2];	/* first of each length in cblenidx*/
+static unsigned long cbidxgen = 0;		/* cbgen the index is made for */
+static uint32_t cbactive = 0;			/* nr of calls matching the filter */
+static unsigned long cbavail = 0;		/* calls available for an attempt */
+
+/* the generated callbase: calls made up from a prefix (weighted roughly by
+ * how often it's heard in contests), a digit, a suffix and sometimes /P or
+ * /M. Prefix, digit and suffix are the digits of the call's number in a
+ * mixed radix, so every number is a different call (or none, some are
+ * left out to get the weights). gen_pick goes through the numbers in the
+ * order of a keyed Feistel permutation, so no call is repeated. */
+#define GENCALLBASE "(generated)"
+#define GENHALF 13						/* bits of each half of a number */
+#define GENMASK ((1UL << GENHALF) - 1)
+#define GENCALLS (1UL << (2 * GENHALF))
+#define GENSUFFIXES (26 + 26*26 + 26*26*26)
+#define GENWMAX 70						/* highest prefix weight */
+#define GENTRIES 1000000				/* for calls matching the filter */
+static int cbgenerated = 0;
+static uint64_t genkey[4];				/* Feistel round keys */
+static uint32_t genpos = 0;				/* next number to permute */
+
+/* adaptive call selection: error statistics per character and per pair of
+ * characters, and a Walker/Vose alias table with a weight for every call.
+ * The table is rebuilt in steps of ADCHUNK calls into the 'next' arrays
+ * while the current one is used. */
+static int adaptive = 0;
+#define ADCHARS 38						/* A-Z, 0-9, /, other */
+#define ADCHUNK 16384
+static unsigned int adseen[ADCHARS], aderr[ADCHARS];
+static unsigned int adseen2[ADCHARS][ADCHARS], aderr2[ADCHARS][ADCHARS];
+static float adrate[ADCHARS], adrate2[ADCHARS][ADCHARS];
+static float *adprob = NULL, *adnprob = NULL, *adw = NULL;
+static uint32_t *adalias = NULL, *adnalias = NULL, *adwork = NULL;
+static float *adprobmem = NULL;			/* the blocks the tables are in; */
+static uint32_t *adaliasmem = NULL;		/* the tables are swapped inside */
+static uint32_t adn = 0;				/* size of the tables */
+static unsigned long adgen = 0;			/* cbgen the tables are made for */
+static int adphase = 0;					/* rebuild: 0 = idle, 1..3 */
+static int addirty = 0;					/* statistics changed */
+static uint32_t adi, adsmall, adlarge;	/* rebuild position, work lists */
+static double adsum;
+
+/* xoshiro256** random number generators: one for the attempt (calls,
+ * pitch, pileups), one for the band conditions, which are computed in the
+ * CW thread */
+struct rng {
+	uint64_t s[4];
+};
+static struct rng rng_main, rng_chan;
+static struct rng rng_chan_next;		/* for the stream thread to take */
+static int rng_chan_pending = 0;
+static uint64_t seed = 0;				/* seed for all attempts, 0 = random */
+
+/* replay file: the seed, settings and every call of the last attempt */
+static FILE *replayfh = NULL;
+
+/* session log (sessions.qsl, next to the toplist): every call of every
+ * attempt, appended as records of LOG_SYNC, the length of the rest, a type
+ * byte, the attempt id, varint fields and a checksum. The id tells apart
+ * the records of several qrq instances, the length and checksum let the
+ * reader skip a record that was cut off.
+ * 'A' start: time, mycall, flags (LOG_*), pileup
+ * 'C' call:  nr, call, input, pitch, speed, points, flags (LOG_*), ms
+ *            from the start of the call to Enter
+ * 'E' end:   score, max. speed */
+#define LOG_MAGIC "QSL2"
+#define LOG_SYNC 0xa5
+#define LOG_ATTEMPTS 16					/* running at once, for --query */
+#define LOG_F6 1						/* call */
+#define LOG_F7 2
+#define LOG_MISSED 4					/* pileup call not copied */
+#define LOG_VALID 1						/* attempt */
+#define LOG_UNLIMITED 2
+#define LOG_CONTINUOUS 4
+#define LOG_SLOWEST 20					/* qrq --query slow */
+static int logfd = -1;
+static uint32_t logid = 0;				/* of the current attempt */
+static unsigned long logstart = 0;		/* start of the current call, ms */
+static int replaybase = 0;				/* score before a resumed attempt */
+
+/* checkpoint of an unlimited attempt (~/.qrq/checkpoint), written every
+ * CHKCALLS calls and when the attempt is aborted: the callbase, filter and
+ * state of the attempt, then the used calls as a bitset (one bit per call
+ * of the callbase, in callbase order). F8 continues the attempt. */
+#define CHKCALLS 20
+struct checkpoint {
+	char callbase[PATH_MAX];
+	char filter[FILTERLEN+1];
+	char mycall[15];
+	long size, mtime;
+	unsigned long calls;
+	int callnr, score, maxspeed, speed, errors;
+};
+
+/* compiled callbase (.qcbx): the header is followed by the offset table
+ * (uint32_t[nr]) and the string area. All in native byte order. The file
+ * is mapped read-only, so all qrq instances share one copy. */
+#define QCBX_MAGIC "QCBX"
+#define QCBX_VERSION 2
+struct qcbx_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t nr;						/* number of calls */
+	uint32_t strsize;					/* size of the string area */
+};
+static void *cbmap = NULL;				/* mapped .qcbx file, or NULL */
+static size_t cbmapsize = 0;
+static char cbloaded[PATH_MAX] = "";	/* file the callbase is from ... */
+static struct stat cbstat;				/* ... and its inode, mtime, size */
+static int cbthread_live = 0;			/* cbthread started, not joined */
+static int cbthread_done = 0;			/* ... and finished (cblock) */
+static char cberror[PATH_MAX + 80] = "";	/* why the last load failed */
+static volatile long cbloadsize = 0;	/* progress of loading, in bytes */
+static volatile long cbloaddone = 0;
 
 const static char *codetable[] = {
 ".-", "-...", "-.-.", "-..", ".", "..-.", "--.", "....", "..",".---",
@@ -84,9 +248,71 @@ const static char *codetable[] = {
 ".--","-..-","-.--","--..","-----",".----","..---","...--","....-",".....",
 "-....", "--...","---..","----."};
 
-/* List of available callbase files. Probably no need to do dynamic memory allocation for that list.... */
-
-static char cblist[100][PATH_MAX];
+/* List of available callbase files, grown as needed. The number of calls
+ * (counted when first shown) is cached in ~/.qrq/callbases along with the
+ * size and mtime of every file, so the files don't have to be opened
+ * again. The directories are only read again when their mtime changes. */
+
+struct cbentry {
+	char *path;
+	long size;
+	time_t mtime;
+	long nr;							/* number of calls, -1 = unknown */
+};
+static struct cbentry *cblist = NULL;
+static int cblistnr = 0, cblistmax = 0;
+static time_t cbdirmtime[3];			/* of the directories searched */
+static int cbcachedirty = 0;
+
+/* the toplist: the file 'toplist' is sorted by score. New results are only
+ * appended to 'toplist.journal', which is merged into the toplist when it
+ * has TLJOURNAL entries. Both are kept in memory, sorted, for the display. */
+struct tlentry {
+	char call[11];
+	int score, maxspeed, timestamp;
+};
+#define TLJOURNAL 256
+#define TLSYNC 8						/* fsync the journal every 8 results */
+static int tlunsynced = 0;
+static struct tlentry *tlbase = NULL, *tljournal = NULL;
+static int tlbasenr = 0, tlbasemax = 0, tljournalnr = 0, tljournalmax = 0;
+static char tlheader[80] = "";			/* first line of the toplist */
+
+/* qrq --merge-toplist: one input in the toplist order (a file, or a run
+ * of an unsorted file, sorted into a temporary file) with its current
+ * entry */
+struct tlstream {
+	FILE *fh;
+	int own;							/* fh is closed after the merge */
+	struct tlentry e;
+	int nr;								/* 1 if e is valid, 0 at the end */
+};
+#define TLRUN 65536						/* results sorted in memory at once */
+static uint64_t *tlseen = NULL;			/* hashes of calls, for the merge */
+static uint32_t tlseenmax = 0, tlseennr = 0;
+
+/* what the toplist panel shows, kept up to date by load_toplist and
+ * add_to_toplist: the first TLTOP entries and the rank of the best result
+ * of tlmycall (0 = none) above them. The row below them is for the score
+ * to beat during an attempt (update_score). Changes by other programs
+ * (qrqscore, another qrq) are noticed by inotify or the files' size and
+ * mtime. */
+#define TLTOP 19
+static struct tlentry tltop[TLTOP];
+static int tltopnr = 0, tlmyrank = 0, tlmybest = 0;
+static char tlmycall[15] = "";
+static struct stat tlst, tljst;			/* of toplist and journal */
+static int tlnotify = -1;				/* inotify descriptor */
+
+/* statistics (F7): all results of stcall, oldest first, and running sums
+ * for the trend (least squares, score per day). Kept up to date with the
+ * toplist. */
+#define STAVG 10						/* moving average of 10 results */
+static struct tlentry *sthist = NULL;
+static int sthistnr = 0, sthistmax = 0;
+static char stcall[15] = "";
+static int stbest = 0, stbestspeed = 0, stfirst = 0;
+static double stsx, stsy, stsxx, stsxy;
 
 static char mycall[15]="DJ1YFK";		/* mycall. will be read from qrqrc */
 static char dspdevice[PATH_MAX]="/dev/dsp";	/* will also be read from qrqrc */
@@ -109,6 +335,10 @@ static int f6=0;						/* f6 = 1: allow unlimited repeats */
 static int fixspeed=0;					/* keep speed fixed, regardless of err*/
 static int unlimitedattempt=0;			/* attempt with all calls  of the DB */
 static int attemptvalid=1;				/* 1 = not using any "cheats" */
+static int continuous=0;				/* 1 = one CW stream for all calls */
+static int callgap=10;					/* gap between calls (cont., dots) */
+#define CALLGAPMAX 100
+static int confpage=0;					/* page of the config dialog (F5) */
 static unsigned long int nrofcalls=0;	
 
 long samplerate=44100;
@@ -116,11 +346,46 @@ static long long_i;
 static int waveform = SINE;				/* waveform: (0 = none) */
 static char wavename[10]="Sine    ";	/* Name of the waveform */
 static double edge=2.0;						/* rise/fall time in milliseconds */
-static int ed;							/* risetime, normalized to samplerate */
+static double ed;						/* risetime, normalized to samplerate */
 
 static short buffer[88200];
 static int full_buf[882000];  /* 20 second max buffer */
 static int full_bufpos = 0;
+static float sig_buf[882000];	/* mono signal from tonegen, -1..1 */
+static int sig_len = 0;
+static double sig_phase = 0;	/* exact time of the next sample in sig_buf,
+								   minus its index (0..1 samples) */
+static float *mixl = NULL, *mixr = NULL;	/* stereo mix for pileups */
+static int mixlen = 0, mixcap = 0;
+
+#define PILEUP "\001"			/* send_cw() text: the current pileup */
+static int pileup=0;					/* nr of calls in a pileup (0 = off)*/
+static int punr=0;						/* calls in the current pileup */
+static char pucall[10][80];
+static int pufreq[10], puspeed[10], pustart[10], pucopied[10], puidx[10];
+static float pugain[10], pupan[10];
+
+/* channel simulator, applied to everything that is sent */
+static int noise=0;						/* add white noise */
+static int snr=10;						/* signal/noise ratio in dB */
+static int qsb=0;						/* slow (Rayleigh) fading */
+static int qrm=0;						/* interfering carrier */
+static int qrn=0;						/* static crashes */
+#define NOISETAB 65536					/* size of the noise table */
+static float *noisetab = NULL;			/* band limited noise, rms = 1 */
+struct channel_state {
+	int pos;							/* position in the noise table */
+	double qsbre, qsbim;				/* fading: complex gain */
+	float qsbgain;						/* gain at end of previous block */
+	double qrmc, qrms, qrmrc, qrmrs;	/* carrier phasor, rotation/block */
+	float qrnamp;						/* amplitude of the current crash */
+	long qrnnext;						/* samples until the next crash */
+};
+static struct channel_state chst = {0, 0.0, 1.0, 1.0f, 1.0, 0.0, 1.0, 0.0, 0, 0};
+#define QRMBLOCK 64
+static float *qrmtab = NULL;			/* QRM carrier, one block */
+static int qrmpitch = 0;				/* CW pitch qrmtab is made for */
+static double qrmoffset = 0;			/* carrier - pitch, Hz */
 
 AUDIO_HANDLE dsp_fd;
 
@@ -130,18 +395,141 @@ static int update_score();
 static int show_error (char * realcall, char * wrongcall); 
 static int clear_display();
 static int add_to_toplist(char * mycall, int score, int maxspeed);
+static void load_toplist ();
+static void read_toplist (FILE *jf);
+static int read_tlentries (FILE *fh, struct tlentry **list, int *max, 
+				int header);
+static void compact_toplist ();
+static FILE *open_replace (const char *filename, char *tmpname);
+static int commit_replace (FILE *fh, const char *tmpname, 
+				const char *filename);
+static void lock_file (int fd, int excl);
+static int merge_toplist (int nr, char **files);
+static int tlmerge_add (struct tlstream **st, int *n, int *max, FILE *fh,
+				int own);
+static int tlmerge_stream (struct tlstream **st, int *n, int *max, FILE *fh,
+				int own);
+static int tlmerge_read (FILE *fh, struct tlentry *e);
+static int tlmerge_seen (const char *call);
+static void unlock_file (int fd);
+static int tlcompare (const void *a, const void *b);
+static struct tlentry *tl_entry (int i, int *jpos, int *bpos);
+static void toplist_view ();
+static void toplist_stat ();
+static void watch_toplist ();
+static void check_toplist_change ();
+static int tl_better (const struct tlentry *e);
+static int tl_rank (int score, int *next);
 static int read_config();
 static int save_config();
-static int tonegen(int freq, int length, int waveform);
+static int tonegen(int freq, double len, double gap, int waveform);
 static void *morse(void * arg); 
+static void render_morse(char *text, int freq, int speed);
+static const char *morse_code (int c);
+static int text_mode (char *filename);
+static void send_cw (char *text);
+static void wait_cw ();
+static int call_freq ();
+static int pick_call (char *call);
 static int add_to_buf(void* data, int size);
+static void add_signal ();
+static void add_stereo (float *l, float *r, int len);
+static void render_cw (char *text, int freq, int speed);
+static void render_pileup ();
+static void mix_voice (float * restrict l, float * restrict r,
+				const float * restrict v, int len, float gl, float gr);
+static void new_pileup (int n);
+static int pileup_round (char *input);
+static void silence (int len);
+static double gauss ();
+static void make_noisetab ();
+static void fading (float *sig, int len);
+static void channel (float *sig, int len, int ch);
+static void add_scaled (float * restrict d, const float * restrict s, int len,
+				float g);
+static void make_qrmtab (int pitch);
+static void qrm_block (float * restrict sig, int len, float c, float s);
+static float add_decaying (float * restrict d, const float * restrict s,
+				int len, float a, float decay);
 static int readline(WINDOW *win, int y, int x, char *line, int i); 
 static void thread_fail (int j);
 static int check_toplist ();
 static int find_files ();
 static int statistics ();
+static void stats_build ();
+static void stats_add (const struct tlentry *e);
+static void stats_sum (const struct tlentry *e);
+static int stats_avg (int k);
+static double stats_trend ();
+static int stcompare (const void *a, const void *b);
+static int stats_svg (const char *filename);
 static int read_callbase ();
+static int load_callbase ();
+static void start_callbase ();
+static void wait_callbase (int show);
+static void *load_thread (void *arg);
+static void show_cbprogress ();
+static int map_callbase (FILE *fh);
+static void free_callbase ();
+static void front_code (int nr);
+static char *cb_call (int i);
+static void reset_calls ();
+static int sample_callbase (int n);
+static int cb_loading ();
+static void cbfail ();
+static int apply_filter ();
+static int parse_filter (char *globs, char **g, int *ng, int *minlen,
+				int *maxlen);
+static int match_filter (const char *c, char **g, int ng, int minlen,
+				int maxlen);
+static int gen_pick (char *call);
+static int gen_call (uint32_t i, char *call);
+static uint32_t gen_perm (uint32_t i);
+static void gen_key ();
+static uint64_t splitmix64 (uint64_t *x);
+static void build_cbindex ();
+static int cbcompare (const void *a, const void *b);
+static int glob_match (const char *pat, const char *str);
+static void use_call (uint32_t j);
+static void char_stats (char *realcall, char *input);
+static int adindex (char c);
+static int adaptive_pick ();
+static void adaptive_step (uint32_t work);
+static void rng_seed (uint64_t seed);
+static void replay_start (uint64_t aseed);
+static void replay_call (char *call, int f, int s, char *input);
+static void replay_end ();
+static int replay_mode (char *filename);
+static void log_start ();
+static void log_call (int nr, char *call, char *input, int f, int s, 
+				int points, int flags);
+static void log_end ();
+static void log_write (unsigned char *rec, int len);
+static int put_varint (unsigned char *p, uint32_t v);
+static int put_string (unsigned char *p, const char *str);
+static int get_varint (unsigned char **p, unsigned char *end, uint32_t *v);
+static int get_string (unsigned char **p, unsigned char *end, char *str,
+				int size);
+static int log_read (FILE *fh, unsigned char *rec, int *skipped);
+static unsigned long now_ms ();
+static int query_log (char *what, int nr, char **files);
+static int save_checkpoint (int nr, const int *skip, int nskip);
+static FILE *read_checkpoint (struct checkpoint *c);
+static int checkpoint_info (struct checkpoint *c);
+static int restore_checkpoint ();
+static void remove_checkpoint ();
+static uint64_t rng_next (struct rng *r);
+static double rng_double (struct rng *r);
+static uint32_t rng_below (struct rng *r, uint32_t n);
+static int morse_units (const char *text);
+static int compile_callbase (char *in, char *out);
 static void find_callbases();
+static void add_callbase (const char *path, long size, time_t mtime, long nr);
+static void check_callbase (struct cbentry *e);
+static long count_calls (const char *path);
+static char *home_file (const char *name);
+static void read_cbcache ();
+static void write_cbcache ();
 static void select_callbase ();
 static void help ();
 static void callbase_dialog();
@@ -149,16 +537,37 @@ static void parameter_dialog();
 static int clear_parameter_display();
 static void update_parameter_dialog();
 
+static int cwthread_live = 0;			/* cwthread started, not joined */
 #ifdef WIN_THREADS
 HANDLE cwthread;
+HANDLE cbthread;
 #else
+pthread_t cbthread;				/* loads the callbase in the background */
+pthread_mutex_t cblock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cbcond = PTHREAD_COND_INITIALIZER;	/* cbthread_done set */
 pthread_t cwthread;				/* thread for CW output, to enable
 								   keyboard reading at the same time */
 pthread_attr_t cwattr;
+
+/* continuous mode: one long-lived output thread, fed by a small queue */
+#define STREAMQ 4
+pthread_t streamthread;
+pthread_mutex_t streamlock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t streamcond = PTHREAD_COND_INITIALIZER;	/* stream_sent++ */
+static int stream_running = 0;
+static char streamq[STREAMQ][80];
+static int streamq_freq[STREAMQ], streamq_speed[STREAMQ];
+static unsigned long stream_queued = 0;	/* nr of texts queued so far */
+static unsigned long stream_sent = 0;		/* nr of texts completely sent */
+static unsigned long stream_wait = 0;		/* sending_complete after this */
+static void *cwstream(void *arg);
+static unsigned long stream_queue (char *text);
+static void stream_await (unsigned long seq);
 #endif
 
 char rcfilename[PATH_MAX]="";			/* filename and path to qrqrc */
 char tlfilename[PATH_MAX]="";			/* filename and path to toplist */
+char tljfilename[PATH_MAX+8]="";		/* ... and its journal */
 char cbfilename[PATH_MAX]="";			/* filename and path to callbase */
 
 char destdir[PATH_MAX]="";
@@ -193,9 +602,51 @@ int main (int argc, char *argv[]) {
 	int i=0,j=0,k=0;						/* counter etc. */
 	char previouscall[80]="";
 	int previousfreq = 0;
-	int f6pressed=0;
+	char call[80]="";
+	char nextcall[80]="";					/* continuous mode lookahead */
+	int nextfreq = 0, havenext = 0;
+	int callidx = 0, nextidx = 0;
+	unsigned long seq = 0, nextseq = 0;
+	int f6pressed=0, f7pressed=0;
+	int resume = 0, aborted, chkpending, firstcall, chkcallnr, skip[10];
+	struct checkpoint chk;
+	char *seedarg = NULL;
+	uint64_t aseed;
+
+	/* random seed from time */
+	rng_seed((uint64_t) time(NULL));
 
-	if (argc > 1) {
+	if (argc == 3 && !strcmp(argv[1], "--text")) {
+		find_files();
+		read_config();
+		return text_mode(argv[2]);
+	}
+	else if (argc == 4 && !strcmp(argv[1], "--compile-callbase")) {
+		return compile_callbase(argv[2], argv[3]);
+	}
+	else if (argc == 3 && !strcmp(argv[1], "--replay")) {
+		find_files();
+		read_config();
+		return replay_mode(argv[2]);
+	}
+	else if (argc >= 3 && !strcmp(argv[1], "--query")) {
+		find_files();
+		return query_log(argv[2], argc - 3, argv + 3);
+	}
+	else if (argc >= 3 && !strcmp(argv[1], "--merge-toplist")) {
+		find_files();
+		read_config();
+		return merge_toplist(argc - 2, argv + 2);
+	}
+	else if (argc == 2 && !strcmp(argv[1], "--save-config")) {
+		find_files();
+		read_config();
+		return save_config();
+	}
+	else if (argc == 3 && !strcmp(argv[1], "--seed")) {
+		seedarg = argv[2];
+	}
+	else if (argc > 1) {
 		help();
 	}
 	
@@ -219,14 +670,13 @@ int main (int argc, char *argv[]) {
 	/* check if the toplist is in the suitable format. as of 0.0.7, each line
 	 * is 31 characters long, with the added time stamp */
 	check_toplist();
+	load_toplist();
+	watch_toplist();
 
 	/* buffer for audio */
 	for (long_i=0;long_i<88200;long_i++) {
 		buffer[long_i]=0;
 	}
-	
-	/* random seed from time */
-	srand( (unsigned) time(NULL) ); 
 
 #ifndef WIN_THREADS
 	/* Initialize cwthread. We have to wait for the cwthread to finish before
@@ -238,17 +688,21 @@ int main (int argc, char *argv[]) {
 	/****** Reading configuration file ******/
 	printw("\nReading configuration file qrqrc \n");
 	read_config();
+	if (seedarg) {
+		seed = strtoull(seedarg, NULL, 10);
+	}
 
 	attemptvalid = 1;
-	if (f6 || fixspeed || unlimitedattempt) {
+	if (f6 || fixspeed || unlimitedattempt || continuous || pileup ||
+					noise || qsb || qrm || qrn || adaptive || cbfilter[0]) {
 		attemptvalid = 0;	
 	}
 
-	/****** Reading callsign database ******/
-	printw("\nReading callsign database... ");
-	nrofcalls = read_callbase();
+	/****** Reading callsign database (in the background) ******/
+	printw("\nReading callsign database %s in the background.\n\n", 
+					basename(cbfilename));
+	start_callbase();
 
-	printw("done. %d calls read.\n\n", nrofcalls);
 	printw("Press any key to continue...");
 
 	refresh();
@@ -275,12 +729,7 @@ int main (int argc, char *argv[]) {
 	keypad(mid_w, TRUE);
 	keypad(conf_w, TRUE);
 
-#ifdef WIN_THREADS
-	cwthread = (HANDLE) _beginthread( morse,0,"QRQ");
-#else
-	/* no need to join here, this is the first possible time CW is sent */
-	pthread_create(&cwthread, NULL, & morse, (void *) "QRQ");
-#endif
+	send_cw("QRQ");
 
 /* very outter loop */
 while (1) {	
@@ -315,13 +764,16 @@ while (status == 1) {
 	mvwaddstr(mid_w,8,2, "errors is credited.");
 	mvwaddstr(mid_w,10,2, "F6 repeats a callsign once, F10 quits.");
 	mvwaddstr(mid_w,12,2, "Settings can be changed with F5 (or in qrqrc).");
-#ifndef WIN32
-	mvwaddstr(mid_w,14,2, "Score statistics (requires gnuplot) with F7.");
-#endif
+	mvwaddstr(mid_w,14,2, "Score statistics with F7.");
+	if (checkpoint_info(&chk)) {
+		mvwprintw(mid_w,15,2, "F8 continues the unlimited attempt (call %d).",
+					chk.callnr);
+	}
 
 	wattron(right_w,A_BOLD);
 	mvwaddstr(right_w,1, 6, "Toplist");
 	wattroff(right_w,A_BOLD);
+	mvwprintw(right_w, TLTOP+3, 2, "%16s", "");	/* no score to beat */
 
 	display_toplist();
 
@@ -342,6 +794,20 @@ while (status == 1) {
 	/* prompt for own callsign */
 	i = readline(bot_w, 1, 30, mycall, 1);
 
+	/* F8 -> continue the unlimited attempt of the checkpoint */
+	if (i == 8) {
+		if (!checkpoint_info(&chk)) {
+			break;
+		}
+		strcpy(mycall, chk.mycall);
+		resume = 1;
+	}
+
+	/* cut excessively long calls, as in the toplist (also for F5/F7) */
+	if (strlen(mycall) > 7) {
+		mycall[7] = '\0';
+	}
+
 	/* F5 -> Configure sound */
 	if (i == 5) {
 		parameter_dialog();
@@ -350,29 +816,17 @@ while (status == 1) {
 	/* F6 -> play test CW */
 	else if (i == 6) {
 		freq = constanttone ? ctonefreq : 800;
-#ifdef WIN_THREADS
-		 WaitForSingleObject(cwthread,INFINITE);
-		 cwthread = (HANDLE) _beginthread( morse,0,"VVVTEST");
-#else
-		pthread_join(cwthread, NULL);
-		j = pthread_create(&cwthread, NULL, &morse, (void *) "VVVTEST");	
-		thread_fail(j);
-#endif
+		send_cw("VVVTEST");
 		break;
 	}
 	else if (i == 7) {
-#ifndef WIN32
 		statistics();
-#endif
 		break;
 	}
 
 	if (strlen(mycall) == 0) {
 		strcpy(mycall, "NOCALL");
 	}
-	else if (strlen(mycall) > 7) {		/* cut excessively long calls */
-		mycall[7] = '\0';
-	}
 	
 	clear_display();
 	wrefresh(mid_w);
@@ -390,38 +844,96 @@ while (status == 1) {
 	wrefresh(top_w);
 
 
-	/* Reread callbase */
-	nrofcalls = read_callbase();
+	/* Reread callbase if the file changed, all calls unused again. With
+	 * a fixed seed, every attempt gets the same calls. */
+	wait_callbase(1);
+	aseed = seed ? seed : rng_next(&rng_main);
+	rng_seed(aseed);
+	if (load_callbase() < 0) {
+		cbfail();
+	}
+	reset_calls();
+	firstcall = 1;
+	if (resume) {
+		resume = 0;
+		if (!(firstcall = restore_checkpoint())) {
+			mvwprintw(bot_w,1,1, "%-58s", 
+					"The checkpoint doesn't match the callbase!");
+			wrefresh(bot_w);
+			getch();
+			break;
+		}
+		update_score();
+		wrefresh(top_w);
+	}
+	replay_start(aseed);
+	log_start();
 
 	/****** send 50 or unlimited calls, ask for input, score ******/
 	
-	for (callnr=1; callnr < (unlimitedattempt ? nrofcalls : 51); callnr++) {
-		/* Make sure to wait for the cwthread of the previous callsign, if
-		 * necessary. */
-#ifdef WIN_THREADS
-		WaitForSingleObject(cwthread,INFINITE);
-#else
-		pthread_join(cwthread, NULL);
-#endif	
-		/* select an unused callsign from the calls-array */
-		do {
-			i = (int) ((float) nrofcalls*rand()/(RAND_MAX+1.0));
-		} while (calls[i] == NULL);
-
-		/* only relevant for callbases with less than 50 calls */
-		if (nrofcalls == callnr) { 		/* Only one call left!" */
-				callnr =  51; 			/* Get out after next one */
+	havenext = 0;
+	aborted = chkpending = 0;
+	chkcallnr = firstcall;
+	for (callnr=firstcall; callnr < (unlimitedattempt ? cbavail : 51); 
+					callnr++) {
+
+		/* unlimited attempts: save the progress now and then (without the
+		 * call that is already queued in continuous mode) */
+		if (unlimitedattempt && callnr - chkcallnr >= CHKCALLS) {
+			save_checkpoint(callnr, &nextidx, havenext);
+			chkcallnr = callnr;
 		}
 
+		/* pileup mode: several calls at once */
+		if (pileup > 1) {
+			wait_cw();
+			k = (unlimitedattempt ? cbavail : 51) - callnr;
+			if (k > cbavail - callnr + 1) {
+				k = cbavail - callnr + 1;
+			}
+			new_pileup(pileup < k ? pileup : k);
+			mvwprintw(bot_w,1,1,"                                      ");
+			mvwprintw(bot_w, 1, 1, "%3d/%s", callnr,
+							unlimitedattempt ? "-" : "50");	
+			wrefresh(bot_w);
+			if (pileup_round(input)) {
+				input[0]='\0';
+				/* the calls not copied yet are sent again */
+				for (j = k = 0; k < punr; k++) {
+					if (!pucopied[k]) {
+						skip[j++] = puidx[k];
+					}
+				}
+				if (unlimitedattempt) {
+					chkpending = save_checkpoint(callnr + punr - j, skip, j);
+				}
+				aborted = 1;
+				break;
+			}
+			callnr += punr - 1;
+			continue;
+		}
 
-
-		/* output frequency handling a) random b) fixed */
-		if ( constanttone == 0 ) {
-				/* random freq, fraction of samplerate */
-				freq = (int) (samplerate/(50+(40.0*rand()/(RAND_MAX+1.0))));
+		/* continuous mode: this call has already been queued into the
+		 * stream right behind the previous one */
+		if (havenext) {
+			strcpy(call, nextcall);
+			callidx = nextidx;
+			freq = nextfreq;
+			seq = nextseq;
+			havenext = 0;
 		}
-		else { /* fixed frequency */
-				freq = ctonefreq;
+		else {
+			/* Make sure to wait for the cwthread of the previous callsign,
+			 * if necessary. */
+			wait_cw();
+			callidx = pick_call(call);
+			freq = call_freq();
+		}
+
+		/* only relevant for callbases with less than 50 calls */
+		if (cbavail == callnr) { 		/* Only one call left!" */
+				callnr =  51; 			/* Get out after next one */
 		}
 
 		mvwprintw(bot_w,1,1,"                                      ");
@@ -433,14 +945,32 @@ while (status == 1) {
 		 * input and echoing at the same time possible */
 		
 		sending_complete = 0;	
-#ifdef WIN_THREADS
-		cwthread = (HANDLE) _beginthread( morse,0,calls[i]);
-#else
-		j = pthread_create(&cwthread, NULL, morse, calls[i]);	
-		thread_fail(j);		
+#ifndef WIN_THREADS
+		if (continuous) {
+			if (seq == 0) {
+				seq = stream_queue(call);
+			}
+			/* queue the next call right away, so the stream goes on
+			 * while this one is typed */
+			if (callnr + 1 < (unlimitedattempt ? cbavail : 51)) {
+				nextidx = pick_call(nextcall);
+				nextfreq = call_freq();
+				k = freq;
+				freq = nextfreq;
+				nextseq = stream_queue(nextcall);
+				freq = k;
+				havenext = 1;
+			}
+			stream_await(seq);
+			seq = 0;
+		}
+		else
 #endif
+		send_cw(call);
+		logstart = now_ms();
 		
 		f6pressed=0;
+		f7pressed=0;
 
 		while (!abort && (j = readline(bot_w, 1, 8, input,1)) > 4) {/* F5..F10 pressed */
 
@@ -451,30 +981,15 @@ while (status == 1) {
 				}
 				f6pressed=1;
 				/* wait for old cwthread to finish, then send call again */
-			
-#ifdef WIN_THREADS
-			WaitForSingleObject(cwthread,INFINITE);
-			cwthread = (HANDLE) _beginthread( morse,0,calls[i]);
-#else
-			pthread_join(cwthread, NULL);
-			j = pthread_create(&cwthread, NULL, &morse, calls[i]);	
-			thread_fail(j);
-#endif	
+				send_cw(call);
 					break; /* 6*/
 				case 7:		/* repeat _previous_ call */
 					if (callnr > 1) {
+						f7pressed = 1;
 						k = freq;
 						freq = previousfreq;
-#ifdef WIN_THREADS
-			WaitForSingleObject(cwthread,INFINITE);
-			cwthread = (HANDLE) _beginthread( morse,0,previouscall);
-			WaitForSingleObject(cwthread,INFINITE);
-#else
-			pthread_join(cwthread, NULL);
-			j = pthread_create(&cwthread, NULL, &morse, previouscall);	
-			thread_fail(j);
-			pthread_join(cwthread, NULL);
-#endif	
+						send_cw(previouscall);
+						wait_cw();
 						/* NB: We must wait for the CW thread before
 						 * we set the freq back -- this blocks keyboard
 						 * input, but in this case it shouldn't matter */
@@ -493,34 +1008,44 @@ while (status == 1) {
 		if (abort) {
 			abort = 0;
 			input[0]='\0';
+			skip[0] = callidx;
+			skip[1] = nextidx;
+			if (unlimitedattempt) {
+				chkpending = save_checkpoint(callnr, skip, havenext ? 2 : 1);
+			}
+			aborted = 1;
 			break;
 		}
 		
 		tmp[0]='\0';	
-		score += calc_score(calls[i], input, speed, tmp);
+		replay_call(call, freq, speed, input);
+		k = speed;
+		j = calc_score(call, input, speed, tmp);
+		score += j;
+		log_call(callnr, call, input, freq, k, j, 
+						(f6pressed ? LOG_F6 : 0) | (f7pressed ? LOG_F7 : 0));
 		update_score();
 		if (strcmp(tmp, "*")) {			/* made an error */
-				show_error(calls[i], tmp);
+				show_error(call, tmp);
 		}
 		input[0]='\0';
-		strncpy(previouscall, calls[i], 80);
+		strncpy(previouscall, call, 80);
 		previousfreq = freq;
-		calls[i] = NULL;
 	}
 
 	/* attempt is over, send AR */
 	callnr = 0;
+	send_cw("+");
+	replay_end();
+	log_end();
+	if (unlimitedattempt && !aborted) {		/* all calls done */
+		remove_checkpoint();
+	}
 	
-#ifdef WIN_THREADS
-		 WaitForSingleObject(cwthread,INFINITE);
-		 cwthread = (HANDLE) _beginthread( morse,0,"+");
-#else
-		pthread_join(cwthread, NULL);
-		j = pthread_create(&cwthread, NULL, &morse, (void *) "+");	
-		thread_fail(j);
-#endif
-	
-	add_to_toplist(mycall, score, maxspeed);
+	/* an attempt that F8 can continue goes into the toplist at its end */
+	if (!chkpending) {
+		add_to_toplist(mycall, score, maxspeed);
+	}
 	
 	curs_set(0);
 	wattron(bot_w,A_BOLD);
@@ -607,6 +1132,65 @@ while ((j = getch()) != 0) {
 		case 'u':
 				unlimitedattempt = (unlimitedattempt ? 0 : 1);
 			break;
+#ifndef WIN_THREADS
+		case 'o':
+			if (!callnr) {					/* Only allow outside of attempt */
+				continuous = (continuous ? 0 : 1);
+			}
+			break;
+#endif
+		case 'g':
+			if (callgap > 1) {
+				callgap--;
+			}
+			break;
+		case 'h':
+			if (callgap < CALLGAPMAX) {
+				callgap++;
+			}
+			break;
+		case 'p':							/* pileup: off, 2..10 calls */
+			if (!callnr) {
+				pileup = (pileup == 0) ? 2 : ((pileup + 1) % 11);
+			}
+			break;
+		case 'n':
+			noise = (noise ? 0 : 1);
+			break;
+		case 'v':
+			if (snr > -20) {
+				snr--;
+			}
+			break;
+		case 'b':
+			if (snr < 40) {
+				snr++;
+			}
+			break;
+		case 'q':
+			qsb = (qsb ? 0 : 1);
+			break;
+		case 'r':
+			qrm = (qrm ? 0 : 1);
+			break;
+		case 'x':
+			qrn = (qrn ? 0 : 1);
+			break;
+		case 'a':
+			adaptive = (adaptive ? 0 : 1);
+			break;
+		case 'i':
+			if (confpage && !callnr) {		/* filter page, outside of attempt */
+				readline(conf_w, 12, 25, cbfilter, 2);
+				wait_callbase(0);
+				reset_calls();
+				p=0;						/* cursor position */
+			}
+			break;
+		case KEY_NPAGE:
+		case KEY_PPAGE:
+			confpage = (confpage ? 0 : 1);
+			break;
 		case KEY_UP: 
 			initialspeed += 10;
 			break;
@@ -660,14 +1244,7 @@ while ((j = getch()) != 0) {
 			break;
 		case KEY_F(6):
 			freq = constanttone ? ctonefreq : 800;
-#ifdef WIN_THREADS
-		 WaitForSingleObject(cwthread,INFINITE);
-		 cwthread = (HANDLE) _beginthread( morse,0,"TESTING");
-#else
-		pthread_join(cwthread, NULL);
-		j = pthread_create(&cwthread, NULL, &morse, (void *) "TESTING");	
-		thread_fail(j);
-#endif
+			send_cw("TESTING");
 			break;
 		case KEY_F(10):
 		case KEY_F(3):
@@ -685,7 +1262,8 @@ while ((j = getch()) != 0) {
 	speed = initialspeed;
 
 	attemptvalid = 1;
-	if (f6 || fixspeed || unlimitedattempt) {
+	if (f6 || fixspeed || unlimitedattempt || continuous || pileup ||
+					noise || qsb || qrm || qrn || adaptive || cbfilter[0]) {
 		attemptvalid = 0;	
 	}
 
@@ -718,36 +1296,93 @@ void update_parameter_dialog () {
 	mvwaddstr(inf_w,1,1, "                                                         ");
 	curs_set(0);
 	wattron(conf_w,A_BOLD);
-	mvwaddstr(conf_w,1,1, "Configuration:          Value                Change");
 	mvwprintw(conf_w,14,2, "      F6                    F10            ");
 	mvwprintw(conf_w,15,2, "      F2");
 	wattroff(conf_w, A_BOLD);
-	mvwprintw(conf_w,2,2, "Initial Speed:         %3d CpM / %3d WpM" 
-					"    up/down", initialspeed, initialspeed/5);
-	mvwprintw(conf_w,3,2, "Min. character Speed:  %3d CpM / %3d WpM" 
-					"    left/right", mincharspeed, mincharspeed/5);
-	mvwprintw(conf_w,4,2, "CW rise/falltime (ms): %1.1f           " 
-					"       +/-", edge);
-	mvwprintw(conf_w,5,2, "Callsign:              %-14s" 
-					"       c", mycall);
-	mvwprintw(conf_w,6,2, "CW pitch (0 = random): %-4d"
-					"                 k/l or 0", (constanttone)?ctonefreq : 0);
-	mvwprintw(conf_w,7,2, "CW waveform:           %-8s"
-					"             w", wavename);
-	mvwprintw(conf_w,8,2, "Allow unlimited F6*:   %-3s"
-					"                  f", (f6 ? "yes" : "no"));
-	mvwprintw(conf_w,9,2, "Fixed CW speed*:       %-3s"
-					"                  s", (fixspeed ? "yes" : "no"));
-	mvwprintw(conf_w,10,2, "Unlimited attempt*:    %-3s"
-					"                  u", (unlimitedattempt ? "yes" : "no"));
-	if (!callnr) {
-		mvwprintw(conf_w,11,2, "Callsign database:     %-15s"
-					"      d (%d)", basename(cbfilename),nrofcalls);
-	}
+	if (confpage == 0) {
+		wattron(conf_w,A_BOLD);
+		mvwaddstr(conf_w,1,1, "Configuration (1/2):    Value                Change");
+		wattroff(conf_w, A_BOLD);
+		mvwprintw(conf_w,2,2, "Initial Speed:         %3d CpM / %3d WpM" 
+						"    up/down", initialspeed, initialspeed/5);
+		mvwprintw(conf_w,3,2, "Min. character Speed:  %3d CpM / %3d WpM" 
+						"    left/right", mincharspeed, mincharspeed/5);
+		mvwprintw(conf_w,4,2, "CW rise/falltime (ms): %1.1f           " 
+						"       +/-", edge);
+		mvwprintw(conf_w,5,2, "Callsign:              %-14s" 
+						"       c", mycall);
+		mvwprintw(conf_w,6,2, "CW pitch (0 = random): %-4d"
+						"                 k/l or 0", (constanttone)?ctonefreq : 0);
+		mvwprintw(conf_w,7,2, "CW waveform:           %-8s"
+						"             w", wavename);
+		mvwprintw(conf_w,8,2, "Allow unlimited F6*:   %-3s"
+						"                  f", (f6 ? "yes" : "no"));
+		mvwprintw(conf_w,9,2, "Fixed CW speed*:       %-3s"
+						"                  s", (fixspeed ? "yes" : "no"));
+		mvwprintw(conf_w,10,2, "Unlimited attempt*:    %-3s"
+						"                  u", (unlimitedattempt ? "yes" : "no"));
+		if (!callnr && cb_loading()) {
+			mvwprintw(conf_w,11,2, "Callsign database:     %-15s"
+							"      d (loading)", basename(cbfilename));
+		}
+		else if (!callnr && cbgenerated) {
+			mvwprintw(conf_w,11,2, "Callsign database:     %-15s"
+							"      d", GENCALLBASE);
+		}
+		else if (!callnr) {
+			mvwprintw(conf_w,11,2, "Callsign database:     %-15s"
+							"      d (%d)", basename(cbfilename), (int) cbtotal);
+		}
 #ifdef OSS
-	mvwprintw(conf_w,12,2, "DSP device:            %-15s"
-					"      e", dspdevice);
+		mvwprintw(conf_w,12,2, "DSP device:            %-15s"
+						"      e", dspdevice);
+#endif
+	}
+	else {
+		wattron(conf_w,A_BOLD);
+		mvwaddstr(conf_w,1,1, "Configuration (2/2):    Value                Change");
+		wattroff(conf_w, A_BOLD);
+#ifndef WIN_THREADS
+		mvwprintw(conf_w,2,2, "Continuous stream*:    %-3s"
+						"                  o", (continuous ? "yes" : "no"));
 #endif
+		mvwprintw(conf_w,3,2, "Gap between calls:     %-3d dots"
+						"             g/h", callgap);
+		if (pileup) {
+			mvwprintw(conf_w,4,2, "Pileup*:               %-2d calls"
+							"             p", pileup);
+		}
+		else {
+			mvwprintw(conf_w,4,2, "Pileup*:               off     "
+							"             p");
+		}
+		if (noise) {
+			mvwprintw(conf_w,6,2, "Noise*:                SNR %3d dB"
+							"           n, v/b", snr);
+		}
+		else {
+			mvwprintw(conf_w,6,2, "Noise*:                off       "
+							"           n, v/b");
+		}
+		mvwprintw(conf_w,7,2, "QSB (fading)*:         %-3s"
+						"                  q", (qsb ? "yes" : "no"));
+		mvwprintw(conf_w,8,2, "QRM (carrier)*:        %-3s"
+						"                  r", (qrm ? "yes" : "no"));
+		mvwprintw(conf_w,9,2, "QRN (static crashes)*: %-3s"
+						"                  x", (qrn ? "yes" : "no"));
+		mvwprintw(conf_w,11,2, "Adaptive selection*:   %-3s"
+						"                  a", (adaptive ? "yes" : "no"));
+		if (!callnr && cb_loading()) {
+			mvwprintw(conf_w,12,2, "Call filter*:          %-15s"
+							"      i", cbfilter[0] ? cbfilter : "none");
+		}
+		else if (!callnr) {
+			mvwprintw(conf_w,12,2, "Call filter*:          %-15s"
+							"      i (%d)", cbfilter[0] ? cbfilter : "none",
+							(int) cbactive);
+		}
+	}
+	mvwprintw(conf_w,13,2, "More settings:                              PgUp/PgDn");
 	mvwprintw(conf_w,14,2, "Press");
 	mvwprintw(conf_w,14,11, "to play sample CW,");
 	mvwprintw(conf_w,14,34, "to go back.");
@@ -782,8 +1417,6 @@ void callbase_dialog () {
 	select_callbase();
 	wrefresh(conf_w);
 
-	nrofcalls = read_callbase();
-
 
 	return;	/* back to config menu */
 }
@@ -822,12 +1455,21 @@ static int readline(WINDOW *win, int y, int x, char *line, int capitals) {
 	curs_set(TRUE);
 	
 	while (1) {
+		/* while the callbase is loading, show the progress now and then */
+		wtimeout(win, win == bot_w && cb_loading() ? 200 : -1);
 		c = wgetch(win);
+		if (c == ERR) {
+			show_cbprogress();
+			wmove(win,y,x+p);
+			wrefresh(win);
+			continue;
+		}
 		if (c == '\n' && sending_complete)
 			break;
 
 		if (((c > 64 && c < 91) || (c > 96 && c < 123) || (c > 47 && c < 58)
-					 || c == '/') && strlen(line) < 14) {
+					 || c == '/' || (capitals == 2 && strchr("*?,-", c))) && 
+					 strlen(line) < (capitals == 2 ? FILTERLEN : 14)) {
 	
 			line[strlen(line)+1]='\0';
 			if (capitals) {
@@ -896,6 +1538,9 @@ static int readline(WINDOW *win, int y, int x, char *line, int capitals) {
 		else if (c == KEY_F(7)) {
 			return 7;
 		}
+		else if (c == KEY_F(8)) {
+			return 8;
+		}
 		else if (c == KEY_F(10)) {				/* quit */
 			if (callnr) {						/* quit attempt only */
 				return 10;
@@ -906,18 +1551,9 @@ static int readline(WINDOW *win, int y, int x, char *line, int capitals) {
 					" highscore to http://fkurz.net/ham/qrqtop.php\n");
 			/* make sure that no more output is running, then send 73 & quit */
 			speed = 200; freq = 800;
-#ifdef WIN_THREADS
-		 WaitForSingleObject(cwthread,INFINITE);
-		 cwthread = (HANDLE) _beginthread( morse,0,"73");
-		 WaitForSingleObject(cwthread,INFINITE);
-#else
-		pthread_join(cwthread, NULL);
-		j = pthread_create(&cwthread, NULL, &morse, (void *) "73");	
-		thread_fail(j);
+			send_cw("73");
 			/* make sure the cw thread doesn't die with the main thread */
-			/* Exit the whole main thread */
-			pthread_join(cwthread, NULL);
-#endif
+			wait_cw();
 			exit(0);
 		}
 		
@@ -930,30 +1566,31 @@ static int readline(WINDOW *win, int y, int x, char *line, int capitals) {
 	return 0;
 }
 
-/* Read toplist and diplay first 10 entries */
+/* display the first TLTOP entries of the toplist and the rank of mycall,
+ * from memory */
 static int display_toplist () {
-	FILE * fh;
-	int i=0;
-	char tmp[35]="";
-	if ((fh = fopen(tlfilename, "a+")) == NULL) {
-		endwin();
-		fprintf(stderr, "Couldn't read or create file '%s'!", tlfilename);
-		exit(EXIT_FAILURE);
+	int i;
+	char tmp[32];
+
+	check_toplist_change();
+	if (strcmp(tlmycall, mycall)) {
+		toplist_view();
 	}
-	rewind(fh);				/* a+ -> end of file, we want the beginning */
-	(void) fgets(tmp, 34, fh);		/* first line not used */
-	while ((feof(fh) == 0) && i < 20) {
-		i++;
-		if (fgets(tmp, 34, fh) != NULL) {
-			tmp[17]='\0';
-			if (strstr(tmp, mycall)) {		/* highlight own call */
-				wattron(right_w, A_BOLD);
-			}
-			mvwaddstr(right_w,i+2, 2, tmp);
-			wattroff(right_w, A_BOLD);
+
+	for (i = 0; i < tltopnr; i++) {
+		sprintf(tmp, "%-10.10s%6d", tltop[i].call, tltop[i].score);
+		if (strstr(tmp, mycall)) {		/* highlight own call */
+			wattron(right_w, A_BOLD);
 		}
+		mvwaddstr(right_w,i+3, 2, tmp);
+		wattroff(right_w, A_BOLD);
+	}
+	if (tlmyrank) {
+		mvwprintw(right_w,2,2, "You: #%-10d", tlmyrank);
+	}
+	else {
+		mvwprintw(right_w,2,2, "%16s", "");
 	}
-	fclose(fh);
 	wrefresh(right_w);
 	return 0;
 }
@@ -968,6 +1605,7 @@ static int calc_score (char * realcall, char * input, int spd, char * output) {
 	int i,x,m=0;
 
 	x = strlen(realcall);
+	char_stats(realcall, input);
 
 	if (strcmp(input, realcall) == 0) {		 /* exact match! */
 		output[0]='*';						/* * == OK, no mistake */
@@ -1006,14 +1644,28 @@ static int calc_score (char * realcall, char * input, int spd, char * output) {
 
 /* print score, current speed and max speed to window */
 static int update_score() {
-	mvwaddstr(top_w,1,20, "Score:                         ");
+	int rank, next, n = tlbasenr + tljournalnr;
+
+	mvwaddstr(top_w,1,20, "Score:                                ");
 	mvwaddstr(top_w,2,20, "Speed:     CpM/    WpM, Max:    /  ");
 	if (attemptvalid) {
 		mvwprintw(top_w, 1, 27, "%6d", score);	
+		/* where the score would be in the toplist now */
+		rank = tl_rank(score, &next) + 1;
+		mvwprintw(top_w, 1, 35, "Rank %d, top %d%%", rank, 
+						(int) ceil(100.0 * rank / (n + 1)));
+		if (next) {
+			mvwprintw(right_w, TLTOP+3, 2, "To beat: %-7d", next);
+		}
+		else {
+			mvwprintw(right_w, TLTOP+3, 2, "%-16s", "Top score!");
+		}
 	}
 	else {
 		mvwprintw(top_w, 1, 27, "[training mode]", score);	
+		mvwprintw(right_w, TLTOP+3, 2, "%16s", "");
 	}
+	wrefresh(right_w);
 	mvwprintw(top_w, 2, 27, "%3d", speed);	
 	mvwprintw(top_w, 2, 35, "%3d", speed/5);	
 	mvwprintw(top_w, 2, 49, "%3d", maxspeed);	
@@ -1069,123 +1721,806 @@ static int clear_parameter_display() {
 }
 
 
-/* write entry into toplist at the right place 
- * going down from the top of the list until the score in the current line is
- * lower than the score made. then */
+/* add_to_toplist appends a result to the journal and sorts it into the
+ * journal in memory. A full journal is merged into the toplist. */
 
 static int add_to_toplist(char * mycall, int score, int maxspeed) {
-	FILE *fh;	
-	char *part1, *part2;
-	char tmp[35]="";
-	char insertline[35]="DJ1YFK     36666 333 1111111111";		/* example */
-						/* call       pts   max timestamp */
-	int i=0, k=0, j=0;
-	int pos = 0;		/* position where first score < our score appears */
-	int timestamp = 0;
-	int len = 32;		/* length of a line. 32 for unix, 33 for Win */
+	struct tlentry e;
+	char line[40];
+	int fd, lo, hi, len;
 
 	/* For the training modes */
 	if (score == 0) {
 		return 0;
 	}
 
-	timestamp = (int) time(NULL);
-	sprintf(insertline, "%-10s%6d %3d %10d", mycall, score, maxspeed, timestamp);
-	
-	if ((fh = fopen(tlfilename, "rb+")) == NULL) {
-		printf("Unable to open toplist file %s!\n", tlfilename);
+	snprintf(e.call, sizeof(e.call), "%s", mycall);
+	e.score = score;
+	e.maxspeed = maxspeed;
+	e.timestamp = (int) time(NULL);
+
+	/* one write, under a lock against a compaction by another qrq */
+	len = sprintf(line, "%-10s%6d %3d %10d\n", e.call, e.score, e.maxspeed,
+					e.timestamp);
+	if ((fd = open(tljfilename, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0) {
+		endwin();
+		fprintf(stderr, "Unable to open toplist journal %s!\n", tljfilename);
 		exit(EXIT_FAILURE);
 	}
-
-	/* find out if we use CRLF or just LF */
-	fgets(tmp, 35, fh);
-	if (tmp[31] == '\r') {	/* CRLF */
-		len = 33;
-		strcat(insertline, "\r\n");
+	lock_file(fd, 1);
+	if (write(fd, line, len) != len) {
+		endwin();
+		fprintf(stderr, "Unable to write toplist journal %s!\n", tljfilename);
+		exit(EXIT_FAILURE);
 	}
-	else {
-		len = 32;
-		strcat(insertline, "\n");
+#ifndef WIN32
+	if (++tlunsynced >= TLSYNC) {
+		fsync(fd);
+		tlunsynced = 0;
+	}
+#endif
+	unlock_file(fd);
+	close(fd);
+
+	if (tljournalnr == tljournalmax) {
+		tljournalmax = tljournalmax ? 2 * tljournalmax : TLJOURNAL;
+		if ((tljournal = realloc(tljournal, 
+				tljournalmax * sizeof(struct tlentry))) == NULL) {
+			fprintf(stderr, "Error: Couldn't allocate %d bytes!\n",
+					(int) (tljournalmax * sizeof(struct tlentry)));
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (lo = 0, hi = tljournalnr; lo < hi; ) {
+		if (tlcompare(&tljournal[(lo + hi) / 2], &e) < 0) {
+			lo = (lo + hi) / 2 + 1;
+		}
+		else {
+			hi = (lo + hi) / 2;
+		}
 	}
+	memmove(tljournal + lo + 1, tljournal + lo, 
+					(tljournalnr - lo) * sizeof(struct tlentry));
+	tljournal[lo] = e;
+	tljournalnr++;
 
-	fseek(fh, 0, SEEK_END);
-	j = ftell(fh);
+	if (tljournalnr >= TLJOURNAL) {
+		compact_toplist();
+		return 0;
+	}
+	toplist_stat();
+
+	/* update the panel: into the top entries? new best of mycall? */
+	lo = tl_better(&e);
+	if (lo < TLTOP) {
+		if (tltopnr < TLTOP) {
+			tltopnr++;
+		}
+		memmove(tltop + lo + 1, tltop + lo, 
+						(tltopnr - lo - 1) * sizeof(struct tlentry));
+		tltop[lo] = e;
+	}
+	if (!strcmp(e.call, tlmycall) && e.score >= tlmybest) {
+		tlmybest = e.score;
+		tlmyrank = lo + 1;
+	}
+	else if (tlmyrank && lo < tlmyrank) {
+		tlmyrank++;
+	}
+	if (!strcmp(e.call, stcall)) {
+		stats_add(&e);
+	}
+	return 0;
+}
 
-	part1 = malloc((size_t) j);
-	part2 = malloc((size_t) j + len);	/* one additional entry */
+/* load_toplist reads the toplist and its journal into memory. The journal
+ * is locked meanwhile, so a compaction can't happen in between. */
 
-	rewind(fh);
+static void load_toplist () {
+	FILE *jf;
 
-	/* read whole toplist */
-	fread(part1, sizeof(char), (size_t) j, fh);
+	snprintf(tljfilename, sizeof(tljfilename), "%s.journal", tlfilename);
+	if ((jf = fopen(tljfilename, "r")) != NULL) {
+		lock_file(fileno(jf), 0);
+	}
+	read_toplist(jf);
+	if (jf) {
+		fclose(jf);						/* also unlocks */
+	}
+}
 
-	/* find first score below "score"; scores at positions 10 + (i*len) */
+/* read_toplist reads the toplist and the already opened (and locked)
+ * journal 'jf', which may be NULL */
 
-	do {
-		for (i = 0 ; i < 6 ; i++) {	
-			tmp[i] = part1[i + (10 + pos*len)];
-		}
-		k = atoi(tmp);
-		pos++;
-	} while (score < k);
- 
-	/* Found it! Insert own score here! */
-	memcpy(part2, part1, len * (pos-1));
-	memcpy(part2 + len * (pos - 1), insertline, len);
-	memcpy(part2 + len * pos , part1 + len * (pos -1), j - len * (pos - 1));
+static void read_toplist (FILE *jf) {
+	FILE *fh;
+	int i, j, k;
 
-	rewind(fh);
-	fwrite(part2, sizeof(char), (size_t) j + len, fh);
-	fclose(fh);
+	tlbasenr = tljournalnr = 0;
+	if ((fh = fopen(tlfilename, "r")) != NULL) {
+		tlbasenr = read_tlentries(fh, &tlbase, &tlbasemax, 1);
+		fclose(fh);
+	}
+	if (jf) {
+		rewind(jf);
+		tljournalnr = read_tlentries(jf, &tljournal, &tljournalmax, 0);
+	}
+	if (!tlheader[0]) {
+		strcpy(tlheader, "Toplist   999999 999 1181234567");
+	}
+	qsort(tlbase, tlbasenr, sizeof(struct tlentry), tlcompare);
+	qsort(tljournal, tljournalnr, sizeof(struct tlentry), tlcompare);
+
+	/* after a crash between writing the toplist and emptying the journal
+	 * (compact_toplist, merge_toplist), its results are in both files.
+	 * Both are sorted, so the copies are found in one pass. */
+	for (i = j = k = 0; j < tljournalnr; j++) {
+		while (i < tlbasenr && tlcompare(&tlbase[i], &tljournal[j]) < 0) {
+			i++;
+		}
+		if (i < tlbasenr && !tlcompare(&tlbase[i], &tljournal[j])) {
+			continue;
+		}
+		tljournal[k++] = tljournal[j];
+	}
+	tljournalnr = k;
+	toplist_stat();
+	toplist_view();
+}
 
-	free(part1);
-	free(part2);
+/* read_tlentries reads the results in a toplist file into 'list' (grown
+ * as needed, 'max' entries allocated) and returns their number. The first
+ * line is kept in tlheader if 'header' is set. */
 
-	return 0;
+static int read_tlentries (FILE *fh, struct tlentry **list, int *max, 
+				int header) {
+	char line[80];
+	int nr = 0;
+	struct tlentry e;
 
+	if (header && fgets(line, sizeof(line), fh) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		snprintf(tlheader, sizeof(tlheader), "%s", line);
+	}
+	while (fgets(line, sizeof(line), fh) != NULL) {
+		if (sscanf(line, "%10s %d %d %d", e.call, &e.score, &e.maxspeed,
+								&e.timestamp) != 4) {
+			continue;
+		}
+		if (nr == *max) {
+			*max = *max ? 2 * *max : 1024;
+			if ((*list = realloc(*list, *max * sizeof(struct tlentry)))
+							== NULL) {
+				fprintf(stderr, "Error: Couldn't allocate %d bytes!\n",
+						(int) (*max * sizeof(struct tlentry)));
+				exit(EXIT_FAILURE);
+			}
+		}
+		(*list)[nr++] = e;
+	}
+	return nr;
 }
 
+/* compact_toplist merges the journal into the toplist file, which is
+ * replaced atomically. Both are read again first, for results of other qrq
+ * instances. The journal is locked only while they are read and for the
+ * rename and the truncation, not while the toplist is written: if another
+ * program replaced the toplist meanwhile, nothing is changed; if results
+ * were added to the journal meanwhile, it stays as it is (its results that
+ * are in the toplist now are skipped by read_toplist). If anything fails,
+ * the old toplist and the journal stay as they are. */
+
+static void compact_toplist () {
+	FILE *fh, *jf;
+	struct tlentry *e;
+	struct stat st, jst, st2, jst2;
+	char tmpname[PATH_MAX+16];
+	int i, j = 0, b = 0;
+
+	if ((jf = fopen(tljfilename, "r+")) == NULL) {
+		return;
+	}
+	lock_file(fileno(jf), 0);
+	if (stat(tlfilename, &st) || fstat(fileno(jf), &jst)) {
+		fclose(jf);
+		return;
+	}
+	read_toplist(jf);
+	unlock_file(fileno(jf));
 
-/* Read config file 
- *
- * TODO contains too much copypasta. write proper function to parse a key=value
- *
- * */
+	if ((fh = open_replace(tlfilename, tmpname)) == NULL) {
+		fclose(jf);
+		return;
+	}
+	fprintf(fh, "%s\n", tlheader);
+	for (i = 0; (e = tl_entry(i, &j, &b)); i++) {
+		fprintf(fh, "%-10s%6d %3d %10d\n", e->call, e->score, e->maxspeed,
+						e->timestamp);
+	}
 
-static int read_config () {
-	FILE *fh;
-	char tmp[80]="";
-	int i=0;
-	int k=0;
-	int line=0;
+	lock_file(fileno(jf), 1);
+	if (stat(tlfilename, &st2) || st2.st_ino != st.st_ino || 
+			st2.st_size != st.st_size || st2.st_mtime != st.st_mtime ||
+			fstat(fileno(jf), &jst2)) {
+		fclose(fh);
+		remove(tmpname);
+		fclose(jf);						/* also unlocks */
+		load_toplist();
+		return;
+	}
+	if (commit_replace(fh, tmpname, tlfilename)) {
+		fclose(jf);
+		return;
+	}
 
-	if ((fh = fopen(rcfilename, "r")) == NULL) {
-		endwin();
-		fprintf(stderr, "Unable to open config file %s!\n", rcfilename);
-		exit(EXIT_FAILURE);
+	/* everything is in the toplist now */
+	if (jst2.st_size == jst.st_size && !ftruncate(fileno(jf), 0)) {
+#ifndef WIN32
+		fsync(fileno(jf));
+#endif
+		tlunsynced = 0;
 	}
+	fclose(jf);							/* also unlocks */
+	load_toplist();
+}
 
-	while ((feof(fh) == 0) && (fgets(tmp, 80, fh) != NULL)) {
-		i=0;
-		line++;
-		tmp[strlen(tmp)-1]='\0';
+/* open_replace opens a new temporary file next to 'filename' (its name in
+ * 'tmpname') with the same permissions. commit_replace writes it to the
+ * disk and renames it to 'filename', so there is always either the old or
+ * the complete new file, even after a crash. Returns 0 if it worked. */
 
-		/* find callsign, speed etc. 
-		 * only allow if the lines are beginning at zero, so stuff can be
-		 * commented out easily; return value if strstr must point to tmp*/
-		if(tmp == strstr(tmp,"callsign=")) {
-			while (isalnum(tmp[i] = toupper(tmp[9+i]))) {
-				i++;
-			}
-			tmp[i]='\0';
-			if (strlen(tmp) < 8) {				/* empty call allowed */
-				strcpy(mycall,tmp);
-				printw("  line  %2d: callsign: >%s<\n", line, mycall);
-			}
-			else {
-				printw("  line  %2d: callsign: >%s< too long. "
-								"Using default >%s<.\n", line, tmp, mycall);
-			}
+static FILE *open_replace (const char *filename, char *tmpname) {
+	struct stat st;
+	int fd;
+
+	sprintf(tmpname, "%s.XXXXXX", filename);
+#ifndef WIN32
+	if ((fd = mkstemp(tmpname)) < 0) {
+		return NULL;
+	}
+	fchmod(fd, stat(filename, &st) ? 0644 : (st.st_mode & 0777));
+	return fdopen(fd, "w");
+#else
+	if (_mktemp(tmpname) == NULL) {
+		return NULL;
+	}
+	return fopen(tmpname, "wb");
+#endif
+}
+
+static int commit_replace (FILE *fh, const char *tmpname, 
+				const char *filename) {
+	int err;
+#ifndef WIN32
+	char dir[PATH_MAX];
+	int fd;
+#endif
+
+	err = (fflush(fh) != 0);
+#ifndef WIN32
+	err |= (fsync(fileno(fh)) != 0);
+#endif
+	err |= (fclose(fh) != 0);
+	if (!err) {
+#ifndef WIN32
+		err = rename(tmpname, filename);
+#else
+		err = !MoveFileEx(tmpname, filename, MOVEFILE_REPLACE_EXISTING);
+#endif
+	}
+	if (err) {
+		remove(tmpname);
+		return -1;
+	}
+
+#ifndef WIN32
+	/* and the rename itself */
+	strcpy(dir, filename);
+	if ((fd = open(dirname(dir), O_RDONLY)) >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+#endif
+	return 0;
+}
+
+/* lock_file waits for an advisory lock on the file 'fd' (exclusive or
+ * shared). Closing any descriptor of the file releases it. No locking on
+ * Windows. */
+
+static void lock_file (int fd, int excl) {
+#ifndef WIN32
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = excl ? F_WRLCK : F_RDLCK;
+	fl.l_whence = SEEK_SET;
+	while (fcntl(fd, F_SETLKW, &fl) == -1 && errno == EINTR)
+		;
+#endif
+}
+
+static void unlock_file (int fd) {
+#ifndef WIN32
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fcntl(fd, F_SETLK, &fl);
+#endif
+}
+
+/* merge_toplist merges the toplist files 'files' (like the public toplist,
+ * as downloaded by qrqscore) and the journal into the toplist, which is
+ * replaced atomically. All inputs are read one line at a time (k-way
+ * merge), so the memory use doesn't depend on their size: the toplist is
+ * sorted when it's written, the other inputs are checked and sorted in
+ * runs if needed (tlmerge_add). Results that are in several files (same
+ * call and time stamp) are written once; as in qrqscore, all results of
+ * mycall are kept, for other calls only the best one. The journal stays
+ * locked until the merge is done. */
+
+static int merge_toplist (int nr, char **files) {
+	struct tlstream *st = NULL;
+	struct tlentry last;
+	FILE *fh, *jf;
+	char tmpname[PATH_MAX+16], line[80];
+	int i, k, n = 0, max = 0, written = 0, dupes = 0, err = 0;
+
+	snprintf(tljfilename, sizeof(tljfilename), "%s.journal", tlfilename);
+	if ((jf = fopen(tljfilename, "r+")) != NULL) {
+		lock_file(fileno(jf), 1);
+		err = tlmerge_add(&st, &n, &max, jf, 0);
+	}
+
+	/* the toplist itself, its first line is the header */
+	if (!err && (fh = fopen(tlfilename, "r")) != NULL) {
+		if (fgets(line, sizeof(line), fh) != NULL) {
+			line[strcspn(line, "\r\n")] = '\0';
+			snprintf(tlheader, sizeof(tlheader), "%s", line);
+		}
+		err = tlmerge_add(&st, &n, &max, fh, 1);
+	}
+	if (!tlheader[0]) {
+		strcpy(tlheader, "Toplist   999999 999 1181234567");
+	}
+	for (i = 0; i < nr && !err; i++) {
+		if ((fh = fopen(files[i], "r")) == NULL) {
+			fprintf(stderr, "Error: Couldn't read '%s'!\n", files[i]);
+			err = 1;
+			break;
+		}
+		err = tlmerge_add(&st, &n, &max, fh, 1);
+	}
+
+	/* the header is a result with a high score, so its copies in the
+	 * other files are dropped like duplicates */
+	memset(&last, 0, sizeof(last));
+	sscanf(tlheader, "%10s %d %d %d", last.call, &last.score, 
+					&last.maxspeed, &last.timestamp);
+
+	if (!err && (fh = open_replace(tlfilename, tmpname)) == NULL) {
+		fprintf(stderr, "Error: Couldn't write '%s'!\n", tlfilename);
+		err = 1;
+	}
+
+	if (!err) {
+		fprintf(fh, "%s\n", tlheader);
+		tlseennr = 0;
+		if (tlseen) {
+			memset(tlseen, 0, tlseenmax * sizeof(uint64_t));
+		}
+		/* only a few inputs, so the next one is found by a linear search.
+		 * All are in the toplist order, so the copies of a result come
+		 * one after another. */
+		while (1) {
+			for (k = -1, i = 0; i < n; i++) {
+				if (st[i].nr && (k < 0 || 
+						tlcompare(&st[i].e, &st[k].e) < 0)) {
+					k = i;
+				}
+			}
+			if (k < 0) {
+				break;
+			}
+			if (!strcmp(st[k].e.call, last.call) && 
+							st[k].e.timestamp == last.timestamp) {
+				dupes++;
+			}
+			else if (!strcmp(st[k].e.call, mycall) || 
+							!tlmerge_seen(st[k].e.call)) {
+				fprintf(fh, "%-10s%6d %3d %10d\n", st[k].e.call, 
+						st[k].e.score, st[k].e.maxspeed, st[k].e.timestamp);
+				written++;
+			}
+			last = st[k].e;
+			st[k].nr = tlmerge_read(st[k].fh, &st[k].e);
+		}
+		if (commit_replace(fh, tmpname, tlfilename)) {
+			fprintf(stderr, "Error: Couldn't write '%s'!\n", tlfilename);
+			err = 1;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (st[i].own) {
+			fclose(st[i].fh);
+		}
+	}
+	free(st);
+	if (jf) {
+		if (!err && !ftruncate(fileno(jf), 0)) {	/* all in the toplist */
+#ifndef WIN32
+			fsync(fileno(jf));
+#endif
+		}
+		fclose(jf);						/* also unlocks */
+	}
+	if (err) {
+		return EXIT_FAILURE;
+	}
+	printf("%s: %d results (%d duplicates)\n", tlfilename, written, dupes);
+	return 0;
+}
+
+/* tlmerge_add adds the rest of the file 'fh' as merge input. If it isn't
+ * in the toplist order (the journal, or an old or foreign toplist), it's
+ * read again in runs of TLRUN results, which are sorted and written to
+ * temporary files; these are the inputs then. 'own': fh may be closed
+ * after the merge (not the locked journal). Returns -1 on errors. */
+
+static int tlmerge_add (struct tlstream **st, int *n, int *max, FILE *fh,
+				int own) {
+	struct tlentry prev, e, *run;
+	FILE *rf;
+	long start = ftell(fh);
+	int i, k, sorted = 1;
+
+	for (i = 0; tlmerge_read(fh, &e); i++) {
+		if (i && tlcompare(&prev, &e) > 0) {
+			sorted = 0;
+			break;
+		}
+		prev = e;
+	}
+	if (start < 0 || fseek(fh, start, SEEK_SET)) {
+		fprintf(stderr, "Error: Couldn't read the toplist files!\n");
+		return -1;
+	}
+	if (sorted) {
+		return tlmerge_stream(st, n, max, fh, own);
+	}
+
+	if ((run = malloc(TLRUN * sizeof(struct tlentry))) == NULL) {
+		fprintf(stderr, "Error: Couldn't allocate %d bytes!\n",
+				(int) (TLRUN * sizeof(struct tlentry)));
+		exit(EXIT_FAILURE);
+	}
+	do {
+		for (k = 0; k < TLRUN && tlmerge_read(fh, &run[k]); k++)
+			;
+		if (!k) {
+			break;
+		}
+		qsort(run, k, sizeof(struct tlentry), tlcompare);
+		if ((rf = tmpfile()) == NULL) {
+			fprintf(stderr, "Error: Couldn't create a temporary file!\n");
+			free(run);
+			return -1;
+		}
+		for (i = 0; i < k; i++) {
+			fprintf(rf, "%-10s%6d %3d %10d\n", run[i].call, run[i].score,
+							run[i].maxspeed, run[i].timestamp);
+		}
+		if (fflush(rf) || fseek(rf, 0, SEEK_SET) ||
+				tlmerge_stream(st, n, max, rf, 1)) {
+			fprintf(stderr, "Error: Couldn't write a temporary file!\n");
+			fclose(rf);
+			free(run);
+			return -1;
+		}
+	} while (k == TLRUN);
+	free(run);
+	if (own) {
+		fclose(fh);
+	}
+	return 0;
+}
+
+/* tlmerge_stream adds 'fh' (in the toplist order) to the merge inputs and
+ * reads its first result */
+
+static int tlmerge_stream (struct tlstream **st, int *n, int *max, FILE *fh,
+				int own) {
+	if (*n == *max) {
+		*max = *max ? 2 * *max : 8;
+		if ((*st = realloc(*st, *max * sizeof(struct tlstream))) == NULL) {
+			fprintf(stderr, "Error: Couldn't allocate %d bytes!\n",
+					(int) (*max * sizeof(struct tlstream)));
+			exit(EXIT_FAILURE);
+		}
+	}
+	(*st)[*n].fh = fh;
+	(*st)[*n].own = own;
+	(*st)[*n].nr = tlmerge_read(fh, &(*st)[*n].e);
+	(*n)++;
+	return 0;
+}
+
+/* tlmerge_read reads the next result in 'fh' into 'e'. Returns 0 at the
+ * end. */
+
+static int tlmerge_read (FILE *fh, struct tlentry *e) {
+	char line[80];
+
+	while (fgets(line, sizeof(line), fh) != NULL) {
+		if (sscanf(line, "%10s %d %d %d", e->call, &e->score, &e->maxspeed,
+						&e->timestamp) == 4) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* tlmerge_seen returns 1 if 'call' was seen before in the merge, and
+ * remembers it otherwise. The calls are kept as 64 bit hashes in a growing
+ * table, so it needs memory for each call, not for each result. */
+
+static int tlmerge_seen (const char *call) {
+	uint64_t h = 0xcbf29ce484222325ULL, *old;	/* FNV-1a */
+	uint32_t i, k, oldmax;
+
+	for (; *call; call++) {
+		h = (h ^ (unsigned char) *call) * 0x100000001b3ULL;
+	}
+	h |= 1;								/* 0 is an empty slot */
+
+	if (2 * (tlseennr + 1) > tlseenmax) {
+		old = tlseen;
+		oldmax = tlseenmax;
+		tlseenmax = tlseenmax ? 2 * tlseenmax : 4096;
+		if ((tlseen = calloc(tlseenmax, sizeof(uint64_t))) == NULL) {
+			fprintf(stderr, "Error: Couldn't allocate %d bytes!\n",
+					(int) (tlseenmax * sizeof(uint64_t)));
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < oldmax; i++) {
+			if (old[i]) {
+				for (k = old[i] % tlseenmax; tlseen[k]; 
+								k = (k + 1) % tlseenmax)
+					;
+				tlseen[k] = old[i];
+			}
+		}
+		free(old);
+	}
+
+	for (k = h % tlseenmax; tlseen[k] && tlseen[k] != h; 
+					k = (k + 1) % tlseenmax)
+		;
+	if (tlseen[k]) {
+		return 1;
+	}
+	tlseen[k] = h;
+	tlseennr++;
+	return 0;
+}
+
+/* toplist_view makes the panel contents from scratch */
+
+static void toplist_view () {
+	struct tlentry *e;
+	int i, j = 0, b = 0;
+
+	stcall[0] = '\0';					/* made again when needed */
+
+	strcpy(tlmycall, mycall);
+	tlmyrank = tlmybest = tltopnr = 0;
+	for (i = 0; (i < TLTOP || !tlmyrank) && (e = tl_entry(i, &j, &b)); i++) {
+		if (i < TLTOP) {
+			tltop[tltopnr++] = *e;
+		}
+		if (!tlmyrank && !strcmp(e->call, mycall)) {	/* the best one */
+			tlmyrank = i + 1;
+			tlmybest = e->score;
+		}
+	}
+}
+
+/* tl_better returns the number of results in the toplist that come
+ * before 'e' (binary search in the toplist and in the journal) */
+
+static int tl_better (const struct tlentry *e) {
+	int lo, hi, n = 0;
+
+	for (lo = 0, hi = tlbasenr; lo < hi; ) {
+		if (tlcompare(&tlbase[(lo + hi) / 2], e) < 0) {
+			lo = (lo + hi) / 2 + 1;
+		}
+		else {
+			hi = (lo + hi) / 2;
+		}
+	}
+	n = lo;
+	for (lo = 0, hi = tljournalnr; lo < hi; ) {
+		if (tlcompare(&tljournal[(lo + hi) / 2], e) < 0) {
+			lo = (lo + hi) / 2 + 1;
+		}
+		else {
+			hi = (lo + hi) / 2;
+		}
+	}
+	return n + lo;
+}
+
+/* tl_rank returns the number of results with a higher score than 'score'
+ * and the lowest of these in 'next' (0 if there is none). Binary search in
+ * the toplist and the journal, which are both sorted. */
+
+static int tl_rank (int score, int *next) {
+	int lo, hi, n;
+
+	for (lo = 0, hi = tlbasenr; lo < hi; ) {
+		if (tlbase[(lo + hi) / 2].score > score) {
+			lo = (lo + hi) / 2 + 1;
+		}
+		else {
+			hi = (lo + hi) / 2;
+		}
+	}
+	n = lo;
+	*next = lo ? tlbase[lo - 1].score : 0;
+	for (lo = 0, hi = tljournalnr; lo < hi; ) {
+		if (tljournal[(lo + hi) / 2].score > score) {
+			lo = (lo + hi) / 2 + 1;
+		}
+		else {
+			hi = (lo + hi) / 2;
+		}
+	}
+	if (lo && (!*next || tljournal[lo - 1].score < *next)) {
+		*next = tljournal[lo - 1].score;
+	}
+	return n + lo;
+}
+
+/* toplist_stat remembers size and mtime of the toplist files as they are
+ * in memory now */
+
+static void toplist_stat () {
+	if (stat(tlfilename, &tlst)) {
+		memset(&tlst, 0, sizeof(tlst));
+	}
+	if (stat(tljfilename, &tljst)) {
+		memset(&tljst, 0, sizeof(tljst));
+	}
+}
+
+/* watch_toplist asks inotify for changes in the toplist's directory.
+ * Without inotify, the files are checked with stat at every repaint. */
+
+static void watch_toplist () {
+#ifdef __linux__
+	char dir[PATH_MAX];
+
+	strcpy(dir, tlfilename);
+	if ((tlnotify = inotify_init1(IN_NONBLOCK)) >= 0 &&
+			inotify_add_watch(tlnotify, dirname(dir), IN_CLOSE_WRITE | 
+				IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0) {
+		close(tlnotify);
+		tlnotify = -1;
+	}
+#endif
+}
+
+/* check_toplist_change reloads the toplist if another program changed
+ * it or the journal */
+
+static void check_toplist_change () {
+	struct stat st, jst;
+	int n = 0;
+#ifdef __linux__
+	char buf[4096];
+
+	if (tlnotify >= 0) {
+		while (read(tlnotify, buf, sizeof(buf)) > 0) {
+			n++;
+		}
+		if (!n) {
+			return;			/* nothing happened in the directory */
+		}
+	}
+#endif
+	if (stat(tlfilename, &st)) {
+		memset(&st, 0, sizeof(st));
+	}
+	if (stat(tljfilename, &jst)) {
+		memset(&jst, 0, sizeof(jst));
+	}
+	if (st.st_ino != tlst.st_ino || st.st_size != tlst.st_size ||
+			st.st_mtime != tlst.st_mtime || jst.st_ino != tljst.st_ino ||
+			jst.st_size != tljst.st_size || jst.st_mtime != tljst.st_mtime) {
+		load_toplist();
+	}
+}
+
+/* tlcompare: higher scores first, newer first for the same score. The
+ * call and speed decide the rest, so the order is the same for every
+ * program and equal results are next to each other (merge_toplist). */
+
+static int tlcompare (const void *a, const void *b) {
+	const struct tlentry *x = a, *y = b;
+	int c;
+
+	if (x->score != y->score) {
+		return (x->score > y->score) ? -1 : 1;
+	}
+	if (x->timestamp != y->timestamp) {
+		return (x->timestamp > y->timestamp) ? -1 : 1;
+	}
+	if ((c = strcmp(x->call, y->call))) {
+		return c;
+	}
+	return (x->maxspeed > y->maxspeed) - (x->maxspeed < y->maxspeed);
+}
+
+/* tl_entry returns entry nr. 'i' of the toplist (with the journal merged
+ * in), or NULL. Called for i = 0, 1, 2...; 'jpos' and 'bpos' (both 0 at
+ * the start) keep the position in the journal and the toplist. */
+
+static struct tlentry *tl_entry (int i, int *jpos, int *bpos) {
+	if (*jpos < tljournalnr && (*bpos >= tlbasenr || 
+			tlcompare(&tljournal[*jpos], &tlbase[*bpos]) <= 0)) {
+		return &tljournal[(*jpos)++];
+	}
+	if (*bpos < tlbasenr) {
+		return &tlbase[(*bpos)++];
+	}
+	return NULL;
+}
+
+
+/* Read config file 
+ *
+ * TODO contains too much copypasta. write proper function to parse a key=value
+ *
+ * */
+
+static int read_config () {
+	FILE *fh;
+	char tmp[80]="";
+	int i=0;
+	int k=0;
+	int line=0;
+
+	if ((fh = fopen(rcfilename, "r")) == NULL) {
+		endwin();
+		fprintf(stderr, "Unable to open config file %s!\n", rcfilename);
+		exit(EXIT_FAILURE);
+	}
+
+	while ((feof(fh) == 0) && (fgets(tmp, 80, fh) != NULL)) {
+		i=0;
+		line++;
+		tmp[strlen(tmp)-1]='\0';
+
+		/* find callsign, speed etc. 
+		 * only allow if the lines are beginning at zero, so stuff can be
+		 * commented out easily; return value if strstr must point to tmp*/
+		if(tmp == strstr(tmp,"callsign=")) {
+			while (isalnum(tmp[i] = toupper(tmp[9+i]))) {
+				i++;
+			}
+			tmp[i]='\0';
+			if (strlen(tmp) < 8) {				/* empty call allowed */
+				strcpy(mycall,tmp);
+				printw("  line  %2d: callsign: >%s<\n", line, mycall);
+			}
+			else {
+				printw("  line  %2d: callsign: >%s< too long. "
+								"Using default >%s<.\n", line, tmp, mycall);
+			}
 		}
 		else if (tmp == strstr(tmp,"initialspeed=")) {
 			while (isdigit(tmp[i] = tmp[13+i])) {
@@ -1300,6 +2635,82 @@ static int read_config () {
 				unlimitedattempt= 1;
 			}
 			printw("  line  %2d: unlim. att.:  %s\n", line, (unlimitedattempt ? "yes":"no"));
+        }
+		else if (tmp == strstr(tmp, "continuous=")) {
+			continuous=0;
+			if (tmp[11] == '1') {
+				continuous = 1;
+			}
+			printw("  line  %2d: continuous:   %s\n", line, (continuous ? "yes":"no"));
+        }
+		else if (tmp == strstr(tmp,"callgap=")) {
+			while (isdigit(tmp[i] = tmp[8+i])) {
+				i++;
+			}
+			tmp[i]='\0';
+			callgap = atoi(tmp);
+			if (callgap < 1) {
+				callgap = 1;
+			}
+			else if (callgap > CALLGAPMAX) {
+				callgap = CALLGAPMAX;
+			}
+			printw("  line  %2d: call gap: %d dots\n", line, callgap);
+		}
+		else if (tmp == strstr(tmp,"pileup=")) {
+			while (isdigit(tmp[i] = tmp[7+i])) {
+				i++;
+			}
+			tmp[i]='\0';
+			pileup = atoi(tmp);
+			if (pileup < 2) {
+				pileup = 0;
+			}
+			else if (pileup > 10) {
+				pileup = 10;
+			}
+			printw("  line  %2d: pileup: %d\n", line, pileup);
+		}
+		else if (tmp == strstr(tmp, "noise=")) {
+			noise = (tmp[6] == '1');
+			printw("  line  %2d: noise:        %s\n", line, (noise ? "yes":"no"));
+        }
+		else if (tmp == strstr(tmp,"snr=")) {
+			while (isdigit(tmp[i] = tmp[4+i]) || tmp[i] == '-') {
+				i++;
+			}
+			tmp[i]='\0';
+			snr = atoi(tmp);
+			printw("  line  %2d: SNR: %d dB\n", line, snr);
+		}
+		else if (tmp == strstr(tmp, "qsb=")) {
+			qsb = (tmp[4] == '1');
+			printw("  line  %2d: QSB:          %s\n", line, (qsb ? "yes":"no"));
+        }
+		else if (tmp == strstr(tmp, "qrm=")) {
+			qrm = (tmp[4] == '1');
+			printw("  line  %2d: QRM:          %s\n", line, (qrm ? "yes":"no"));
+        }
+		else if (tmp == strstr(tmp, "qrn=")) {
+			qrn = (tmp[4] == '1');
+			printw("  line  %2d: QRN:          %s\n", line, (qrn ? "yes":"no"));
+        }
+		else if (tmp == strstr(tmp, "adaptive=")) {
+			adaptive = (tmp[9] == '1');
+			printw("  line  %2d: adaptive:     %s\n", line, (adaptive ? "yes":"no"));
+        }
+		else if (tmp == strstr(tmp,"filter=")) {
+			while (isgraph(tmp[i] = toupper(tmp[7+i])) && i < FILTERLEN) {
+				i++;
+			}
+			tmp[i]='\0';
+			strcpy(cbfilter, tmp);
+			printw("  line  %2d: call filter: >%s<\n", line, cbfilter);
+		}
+		else if (tmp == strstr(tmp, "streamcallbase=")) {
+			streamcallbase = (tmp[15] == '1');
+			printw("  line  %2d: stream callbase: %s\n", line, 
+							(streamcallbase ? "yes":"no"));
         }
 		else if (tmp == strstr(tmp,"callbase=")) {
 			while (isgraph(tmp[i] = tmp[9+i])) {
@@ -1315,6 +2726,11 @@ static int read_config () {
 								"Using default >%s<.\n", line, tmp, cbfilename);
 			}
 		}
+		else if (tmp == strstr(tmp,"seed=")) {
+			seed = strtoull(tmp+5, NULL, 10);
+			printw("  line  %2d: seed: %llu\n", line, 
+							(unsigned long long) seed);
+		}
 		else if (tmp == strstr(tmp,"samplerate=")) {
 			while (isdigit(tmp[i] = tmp[11+i])) {
 				i++;
@@ -1332,9 +2748,6 @@ static int read_config () {
 
 static void *morse(void *arg) { 
 	char * text = arg;
-	int i,j;
-	int c, fulldotlen, dotlen, dashlen, charspeed, farnsworth, fwdotlen;
-	const char *code;
 
 #if WIN32 /* WinMM simple support by Lukasz Komsta, SP8QED */
 	HWAVEOUT		h;
@@ -1361,13 +2774,49 @@ static void *morse(void *arg) {
 	full_bufpos = 0; 
 
 	/* Some silence; otherwise the call starts right after pressing enter */
-	tonegen(0, samplerate/4, SILENCE);
+	tonegen(0, 0, samplerate/4, SILENCE);
+	add_signal();
 
-	/* Farnsworth? */
+	render_cw(text, freq, speed);
+
+#if !defined(PA) && !defined(CA)
+	add_to_buf(buffer, 88200);
+#endif
+
+#if WIN32
+	wh.lpData = (char*) &full_buf[0];
+	wh.dwBufferLength = full_bufpos - 2;
+	wh.dwFlags = 0;
+	wh.dwLoops = 0;
+	waveOutPrepareHeader(h, &wh, sizeof(wh));
+	ResetEvent(d);
+	waveOutWrite(h, &wh, sizeof(wh));
+	if(WaitForSingleObject(d, INFINITE) != WAIT_OBJECT_0);
+	waveOutUnprepareHeader(h, &wh, sizeof(wh));
+	waveOutClose(h);
+	CloseHandle(d);
+#else
+	write_audio(dsp_fd, &full_buf[0], full_bufpos);
+	close_audio(dsp_fd);
+#endif
+	sending_complete = 1;
+	return NULL;
+}
+
+/* render_morse appends the CW for 'text' at 'freq' and 'speed' (CpM) to
+ * full_buf, including the space after the last character */
+
+static void render_morse (char *text, int freq, int speed) {
+	int i,j;
+	int c, charspeed, farnsworth;
+	double dotlen, fwdotlen = 0;
+	const char *code;
+
+	/* Farnsworth? */
 	if (speed < mincharspeed) {
 			charspeed = mincharspeed;
 			farnsworth = 1;
-			fwdotlen = (int) (samplerate * 6/speed);
+			fwdotlen = samplerate * 6.0/speed;
 	}
 	else {
 		charspeed = speed;
@@ -1376,602 +2825,3454 @@ static void *morse(void *arg) {
 
 	/* speed is in LpM now, so we have to calculate the dot-length in
 	 * milliseconds using the well-known formula  dotlength= 60/(wpm*50) 
-	 * and then to samples */
+	 * and then to samples. The lengths are not rounded to whole samples,
+	 * tonegen() places every element at its exact (fractional) position. */
 
-	dotlen = (int) (samplerate * 6/charspeed);
-	fulldotlen = dotlen;
-	dashlen = 3*dotlen;
+	dotlen = samplerate * 6.0/charspeed;
 
-	/* edge = length of rise/fall time in ms. ed = in samples */
+	/* edge = length of rise/fall time in ms. ed = in samples. At very
+	 * high speeds, the edges can't be longer than a dot. */
 
-	ed = (int) (samplerate * (edge/1000.0));
-
-	/* the signal needs "ed" samples to reach the full amplitude and
-	 * at the end another "ed" samples to reach zero. The dots and
-	 * dashes therefore are becoming longer by "ed" and the pauses
-	 * after them are shortened accordingly by "ed" samples */
+	ed = samplerate * (edge/1000.0);
+	if (ed > dotlen) {
+		ed = dotlen;
+	}
 
 	for (i = 0; i < strlen(text); i++) {
-		c = text[i];
-		if (isalpha(c)) {
-			code = codetable[c-65];
-		}
-		else if (isdigit(c)) {
-			code = codetable[c-22];
-		}
-		else if (c == '/') { 
-			code = "-..-.";
-		}
-		else if (c == '+') {
-			code = ".-.-.";
-		}
-		else {						/* not supposed to happen! */
-			code = "..--..";
+		if ((code = morse_code(text[i])) == NULL) {
+			code = "..--..";		/* not supposed to happen! */
 		}
 		
 		/* code is now available as string with - and . */
 
 		for (j = 0; j < strlen(code) ; j++) {
 			c = code[j];
-			if (c == '.') {
-				tonegen(freq, dotlen + ed, waveform);
-				tonegen(0, fulldotlen - ed, SILENCE);
-			}
-			else {
-				tonegen(freq, dashlen + ed, waveform);
-				tonegen(0, fulldotlen - ed, SILENCE);
-			}
+			tonegen(freq, (c == '.' ? 1 : 3) * dotlen, dotlen, waveform);
 		}
 		if (farnsworth) {
-			tonegen(0, 3*fwdotlen - fulldotlen, SILENCE);
+			tonegen(0, 0, 3*fwdotlen - dotlen, SILENCE);
 		}
 		else {
-			tonegen(0, 2*fulldotlen, SILENCE);
+			tonegen(0, 0, 2*dotlen, SILENCE);
 		}
 	}
+}
 
+/* render_cw renders 'text' to full_buf; PILEUP renders the current
+ * pileup instead */
 
-#if !defined(PA) && !defined(CA)
-	add_to_buf(buffer, 88200);
-#endif
+static void render_cw (char *text, int freq, int speed) {
+	int pitch = strcmp(text, PILEUP) ? freq : pufreq[0];
 
-#if WIN32
-	wh.lpData = (char*) &full_buf[0];
-	wh.dwBufferLength = full_bufpos - 2;
-	wh.dwFlags = 0;
-	wh.dwLoops = 0;
-	waveOutPrepareHeader(h, &wh, sizeof(wh));
-	ResetEvent(d);
-	waveOutWrite(h, &wh, sizeof(wh));
-	if(WaitForSingleObject(d, INFINITE) != WAIT_OBJECT_0);
-	waveOutUnprepareHeader(h, &wh, sizeof(wh));
-	waveOutClose(h);
-	CloseHandle(d);
-#else
-	write_audio(dsp_fd, &full_buf[0], full_bufpos);
-	close_audio(dsp_fd);
-#endif
-	sending_complete = 1;
-	return NULL;
+	if (qrm && (qrmtab == NULL || pitch != qrmpitch)) {
+		make_qrmtab(pitch);				/* QRM follows the pitch */
+	}
+	if (!strcmp(text, PILEUP)) {
+		render_pileup();
+	}
+	else {
+		render_morse(text, freq, speed);
+		fading(sig_buf, sig_len);
+		add_signal();
+	}
 }
 
-static int add_to_buf(void* data, int size)
-{
-	memcpy(&full_buf[full_bufpos / sizeof(int)], data, size);
-	full_bufpos += size;
-	return 0;
-}	
-
-/* tonegen generates a sinus tone of frequency 'freq' and length 'len' (samples)
- * based on 'samplerate', 'edge' (rise/falltime) */
-
-static int tonegen (int freq, int len, int waveform) {
-	int x=0;
-	int out;
-	double val=0;
+/* silence adds 'len' samples without any CW to full_buf; they still go
+ * through the channel simulator (noise, QRM, QRN) */
 
-	for (x=0; x < len-1; x++) {
-		switch (waveform) {
-			case SINE:
-				val = sin(2*PI*freq*x/samplerate);
-				break;
-			case SAWTOOTH:
-				val=((1.0*freq*x/samplerate)-floor(1.0*freq*x/samplerate))-0.5;
-				break;
-			case SQUARE:
-				val = ceil(sin(2*PI*freq*x/samplerate))-0.5;
-				break;
-			case SILENCE:
-				val = 0;
-		}
+static void silence (int len) {
+	if (len > (int) (sizeof(sig_buf) / sizeof(float))) {
+		len = sizeof(sig_buf) / sizeof(float);
+	}
+	memset(sig_buf, 0, len * sizeof(float));
+	sig_len = len;
+	add_signal();
+}
 
+/* new_pileup picks 'n' calls for a pileup and gives every one its own
+ * pitch, speed, start time, loudness and position in the stereo panorama */
 
-		if (x < ed) { val *= pow(sin(PI*x/(2.0*ed)),2); }	/* rising edge */
+static void new_pileup (int n) {
+	int v;
 
-		if (x > (len-ed)) {								/* falling edge */
-				val *= pow(sin(2*PI*(x-(len-ed)+ed)/(4*ed)),2); 
+	punr = n;
+	for (v = 0; v < n; v++) {
+		puidx[v] = pick_call(pucall[v]);
+		if (constanttone) {			/* spread around the constant tone */
+			pufreq[v] = ctonefreq - 200 + (int) (400.0*rng_double(&rng_main));
 		}
-		
-		out = (int) (val * 32500.0);
-#ifndef PA
-		out = out + (out<<16);	/* stereo only for OSS & CoreAudio*/
-#endif
-		add_to_buf(&out, sizeof(out));
+		else {
+			pufreq[v] = call_freq();
+		}
+		puspeed[v] = (int) (speed * (0.8 + 0.4*rng_double(&rng_main)));
+		pustart[v] = (int) (samplerate * 1.5*rng_double(&rng_main));
+		pugain[v] = (float) ((0.4 + 0.6*rng_double(&rng_main)) / sqrt(n));
+		pupan[v] = (float) rng_double(&rng_main);
+		pucopied[v] = 0;
 	}
-	return 0;
 }
 
-/* Save config file
- *
- * Tries to keep the old format (including comments, etc.) and adds
- * config options that were not used yet in the file to the end 
- * */
+/* render_pileup renders all calls of the current pileup one after another
+ * into sig_buf and mixes them into the stereo buffers mixl/mixr, which are
+ * then added to full_buf. */
+
+static void render_pileup () {
+	int v, end;
+	float gl, gr;
+
+	mixlen = 0;
+	for (v = 0; v < punr; v++) {
+		sig_len = 0;
+		sig_phase = 0;
+		render_morse(pucall[v], pufreq[v], puspeed[v]);
+		fading(sig_buf, sig_len);
+
+		end = pustart[v] + sig_len;
+		if (end > mixcap) {
+			mixcap = end;
+			mixl = realloc(mixl, mixcap * sizeof(float));
+			mixr = realloc(mixr, mixcap * sizeof(float));
+			if (mixl == NULL || mixr == NULL) {
+				fprintf(stderr, "Error: Couldn't allocate %d bytes!\n", 
+								(int) (mixcap * sizeof(float)));
+				exit(EXIT_FAILURE);
+			}
+		}
+		if (end > mixlen) {
+			memset(mixl + mixlen, 0, (end - mixlen) * sizeof(float));
+			memset(mixr + mixlen, 0, (end - mixlen) * sizeof(float));
+			mixlen = end;
+		}
 
-static int save_config () {
-	FILE *fh;
-	char tmp[80]="";
-	char confopts[12][80] = {
-		"\ncallsign=", 
-		"\ncallbase=",
-		"\ndspdevice=", 
-		"\ninitialspeed=", 
-		"\nmincharspeed=",
-		"\nwaveform=", 
-		"\nconstanttone=",
-		"\nctonefreq=", 
-		"\nfixspeed=", 
-		"\nunlimitedattempt=", 
-		"\nf6=", 
-		"\nrisetime=" 
-	};
-	char *conf1;
-	char *conf2;
-	char *find, *findend;
-	int i, len, conf1len, conf2len;
-	int j;
+		/* equal power panning */
+		gl = pugain[v] * cos(pupan[v] * PI/2);
+		gr = pugain[v] * sin(pupan[v] * PI/2);
+		mix_voice(mixl + pustart[v], mixr + pustart[v], sig_buf, sig_len,
+						gl, gr);
+	}
+	sig_len = 0;
 
-	conf2 = malloc(1);
+	add_stereo(mixl, mixr, mixlen);
+}
 
-	if ((fh = fopen(rcfilename, "rb")) == NULL) {
-		endwin();
-		fprintf(stderr, "Unable to open config file '%s'!\n", rcfilename);
-		exit(EXIT_FAILURE);
+/* mix_voice adds one voice to the left and right channel. Kept trivial so
+ * the compiler can vectorize it. */
+
+static void mix_voice (float * restrict l, float * restrict r,
+				const float * restrict v, int len, float gl, float gr) {
+	int i;
+	for (i = 0; i < len; i++) {
+		l[i] += gl * v[i];
+		r[i] += gr * v[i];
 	}
+}
 
-	fseek(fh, 0, SEEK_END);
-	j = (int) ftell(fh);
-	conf1 = malloc((size_t) j+1);
+/* pileup_round sends the current pileup and reads the calls the user
+ * copied, one per line, until an empty line is entered. Every entry is
+ * scored against the not yet copied call it matches best; calls nobody
+ * copied are shown as errors. Returns 1 if the attempt was aborted. */
 
-	rewind(fh);
-	i = fread(conf1, sizeof(char), (size_t) j, fh);
-	conf1[j] = '\0';
-	conf1len = j;
+static int pileup_round (char *input) {
+	int i, j, v, m, best, copied = 0, f6pressed = 0, points;
+	char tmp[80];
 
-	fclose(fh);
+	sending_complete = 0;
+#ifndef WIN_THREADS
+	if (continuous) {
+		stream_await(stream_queue(PILEUP));
+	}
+	else
+#endif
+	send_cw(PILEUP);
+	logstart = now_ms();
 
-	/* The whole config file is now in conf1 
-	 *
-	 * For each config option, search&replace it with the current value.
-	 * Only accept key=value pairs if the key starts on pos 0 of the line
-	 * */
+	while (1) {
+		mvwprintw(bot_w, 1, 30, "%2d/%d copied", copied, punr);
 
-	//endwin();
-	for (i = 0; i < 12; i++) {
-		/* assemble new string for this conf option*/
-		switch (i) {
-			case 0:
-				sprintf(tmp, "%s%s ", confopts[i], mycall);
-				break;
-			case 1:
-				sprintf(tmp, "%s%s ", confopts[i], cbfilename);
-				break;
-			case 2:
-				sprintf(tmp, "%s%s ", confopts[i], dspdevice);
-				break;
-			case 3:
-				sprintf(tmp, "%s%d ", confopts[i], initialspeed);
-				break;
-			case 4:
-				sprintf(tmp, "%s%d ", confopts[i], mincharspeed);
-				break;
-			case 5:
-				sprintf(tmp, "%s%d ", confopts[i], waveform);
-				break;
-			case 6:
-				sprintf(tmp, "%s%d ", confopts[i], constanttone);
-				break;
-			case 7:
-				sprintf(tmp, "%s%d ", confopts[i], ctonefreq);
-				break;
-			case 8:
-				sprintf(tmp, "%s%d ", confopts[i], fixspeed);
-				break;
-			case 9:
-				sprintf(tmp, "%s%d ", confopts[i], unlimitedattempt);
-				break;
-			case 10:
-				sprintf(tmp, "%s%d ", confopts[i], f6);
-				break;
-			case 11:
-				sprintf(tmp, "%s%f ", confopts[i], edge);
-				break;
-		}	
+		while ((j = readline(bot_w, 1, 8, input, 1)) > 4) {
+			if (j == 6 && (f6 || !f6pressed)) {		/* repeat pileup */
+				f6pressed = 1;
+				send_cw(PILEUP);
+			}
+			else if (j == 10) {
+				return 1;
+			}
+		}
 
-		/* Conf option already in rc-file? */
-		if ((find = strstr(conf1, confopts[i])) != NULL) {
-			/* determine length. */
-			findend = find;
-			findend++;	/* starts with \n, always skip it */
-			while (!isspace(*findend++));
-			len = findend - find;
-			
-			/* old size of conf1: conf1len (see above) 
-			 * new size: conf1len - len + strlen(tmp)*/
-			conf2len = conf1len - len + strlen(tmp);
-			conf2 = realloc(conf2, (size_t) conf2len);
-			memcpy(conf2, conf1, (find - conf1));
-			memcpy(conf2 + (find - conf1), tmp, strlen(tmp));
-			memcpy(conf2 + (find - conf1) + strlen(tmp), findend, 
-					(size_t) conf2len - (find - conf1) - strlen(tmp));
+		if (strlen(input) == 0) {
+			break;
 		}
-		/* otherwise, add to the end */
-		else {
-			/* CR LF or LF only? */
-			if (strstr(conf1, "\r")) {
-				strcat(tmp, "\r");
+
+		best = -1;
+		m = -1;
+		for (v = 0; v < punr; v++) {
+			if (pucopied[v]) {
+				continue;
+			}
+			for (i = j = 0; pucall[v][i] && input[i]; i++) {
+				if (pucall[v][i] == input[i]) {
+					j++;
+				}
+			}
+			if (strcmp(pucall[v], input) == 0) {
+				j = 100;
+			}
+			if (j > m) {
+				m = j;
+				best = v;
 			}
-			strcat(tmp, "\n");
-			conf2len = conf1len + strlen(tmp) - 1;
-			conf2 = realloc(conf2, conf2len);
-			memcpy(conf2, conf1, conf1len-1);  // excl. \0
-			memcpy(conf2 + conf1len - 1, tmp, strlen(tmp)); // (incl. \0)
 		}
-		conf1 = realloc(conf1, (size_t) conf2len);
-		conf1len = conf2len;
-		if (conf1 == NULL) {
-			exit(0);
+
+		if (best >= 0) {
+			tmp[0]='\0';
+			replay_call(pucall[best], pufreq[best], puspeed[best], input);
+			points = calc_score(pucall[best], input, puspeed[best], tmp);
+			score += points;
+			log_call(callnr + best, pucall[best], input, pufreq[best], 
+						puspeed[best], points, f6pressed ? LOG_F6 : 0);
+			update_score();
+			if (strcmp(tmp, "*")) {
+				show_error(pucall[best], tmp);
+			}
+			else {
+				copied++;
+			}
+			pucopied[best] = 1;
 		}
-		memcpy(conf1, conf2, conf1len);
+		input[0] = '\0';
+		mvwaddstr(bot_w, 1, 8, "                ");
 	}
 
-	if ((fh = fopen(rcfilename, "wb")) == NULL) {
-		endwin();
-		fprintf(stderr, "Unable to open config file '%s'!\n", rcfilename);
-		exit(EXIT_FAILURE);
+	for (v = 0; v < punr; v++) {
+		if (!pucopied[v]) {
+			replay_call(pucall[v], pufreq[v], puspeed[v], NULL);
+			log_call(callnr + v, pucall[v], "", pufreq[v], puspeed[v], 0,
+						LOG_MISSED | (f6pressed ? LOG_F6 : 0));
+			errornr++;
+			show_error(pucall[v], "-");
+		}
 	}
+	mvwaddstr(bot_w, 1, 30, "            ");
+	return 0;
+}
 
-	fwrite(conf1, conf1len, sizeof(char), fh); 
-	fclose(fh);
+/* morse_code returns the code of character 'c' as a string with - and .,
+ * or NULL if there is none */
 
-	free(conf1);
-	free(conf2);
+static const char *morse_code (int c) {
+	const char *punct = ".,?=-'():\"@";
+	const static char *punctcode[] = { ".-.-.-", "--..--", "..--..", "-...-",
+		"-....-", ".----.", "-.--.", "-.--.-", "---...", ".-..-.", ".--.-." };
 
-	return 0;
-}
-		
-static void thread_fail (int j) {
-	if (j) {
-		endwin();
-		perror("Error: Unable to create cwthread!\n");
-		exit(EXIT_FAILURE);
+	if (isupper(c)) {
+		return codetable[c-65];
+	}
+	else if (isdigit(c)) {
+		return codetable[c-22];
 	}
+	else if (c == '/') { 
+		return "-..-.";
+	}
+	else if (c == '+') {
+		return ".-.-.";
+	}
+	else if (c && strchr(punct, c)) {
+		return punctcode[strchr(punct, c) - punct];
+	}
+	return NULL;
 }
 
-/* Add timestamps to toplist file if not there yet */
-static int check_toplist () {
-	char line[80]="";
-	char tmp[80]="";
+/* text_mode: sends an arbitrary text file as continuous CW with the speed
+ * and Farnsworth timing from qrqrc. The file is read and sent character by
+ * character, so memory use doesn't depend on the size of the file. */
+
+static int text_mode (char *filename) {
 	FILE *fh;
-	FILE *fh2;
+	int c, space = 0;
+	char text[2] = "";
+	double fwdotlen;
 
-	if ((fh = fopen(tlfilename, "r+")) == NULL) {
-		endwin();
-		perror("Unable to open toplist file 'toplist'!\n");
-		exit(EXIT_FAILURE);
+	if ((fh = fopen(filename, "r")) == NULL) {
+		fprintf(stderr, "Error: Couldn't read text file '%s'!\n", filename);
+		return EXIT_FAILURE;
 	}
 
-	fgets(tmp, 35, fh);
-	
-	rewind(fh);
-	
-	if (strlen(tmp) == 21) {
-			printw("Toplist file in old format. Converting...");
-			strcpy(tmp, "cp -f ");
-			strcat(tmp, tlfilename);
-			strcat(tmp, " /tmp/qrq-toplist");
-			if (system(tmp)) {
+	speed = initialspeed;
+	freq = constanttone ? ctonefreq : 800;
+	fwdotlen = samplerate * 6.0/speed;
+
+#ifndef WIN32
+	dsp_fd = open_dsp(dspdevice);
+#endif
+
+	while ((c = getc(fh)) != EOF) {
+		c = toupper(c);
+		if (isspace(c)) {
+			space = 1;
+			continue;
+		}
+		if (morse_code(c) == NULL) {
+			continue;
+		}
+
+		full_bufpos = 0;
+		/* word space: 7 dots, the 3 of the character space are already in */
+		if (space) {
+			tonegen(0, 0, 4*fwdotlen, SILENCE);
+			add_signal();
+			putchar(' ');
+			space = 0;
+		}
+		text[0] = c;
+		render_cw(text, freq, speed);
+		putchar(c);
+		fflush(stdout);
+#ifndef WIN32
+		write_audio(dsp_fd, &full_buf[0], full_bufpos);
+		flush_audio(dsp_fd);
+#endif
+	}
+
+#ifndef WIN32
+	close_audio(dsp_fd);
+#endif
+	putchar('\n');
+	fclose(fh);
+	return 0;
+}
+
+#ifndef WIN_THREADS
+
+/* cwstream: output thread for the continuous mode. The audio device is
+ * opened once and never stopped: when nothing is queued, silence is written
+ * in short blocks. Queued texts are rendered and written right behind it, so
+ * the position of every call in the stream is exact to the sample. Between
+ * two calls there are at least 'callgap' dots of the new call's speed.  */
+
+static void *cwstream (void *arg) {
+	char text[80];
+	int f, s, n, block;
+	long idle = 0;			/* samples of silence since the last call */
+	long gap;
+
+	dsp_fd = open_dsp(dspdevice);
+	block = samplerate/50;		/* 20ms */
+	idle = samplerate;
+
+	while (1) {
+		pthread_mutex_lock(&streamlock);
+		if (rng_chan_pending) {			/* new seed from rng_seed() */
+			rng_chan = rng_chan_next;
+			rng_chan_pending = 0;
+		}
+		n = (stream_sent < stream_queued);
+		if (n) {
+			strcpy(text, streamq[stream_sent % STREAMQ]);
+			f = streamq_freq[stream_sent % STREAMQ];
+			s = streamq_speed[stream_sent % STREAMQ];
+		}
+		pthread_mutex_unlock(&streamlock);
+
+		full_bufpos = 0;
+		if (!n) {					/* nothing to send, keep stream going */
+			silence(block);
+			write_audio(dsp_fd, &full_buf[0], full_bufpos);
+			flush_audio(dsp_fd);
+			idle += block;
+			continue;
+		}
+
+		/* remaining part of the gap in front of this text, in blocks like
+		 * the idle stream, so any gap fits into the buffers */
+		gap = (long) (callgap * (samplerate * 6.0/(s < mincharspeed ? 
+								mincharspeed : s))) - idle;
+		while (gap > 0) {
+			silence(gap < block ? gap : block);
+			write_audio(dsp_fd, &full_buf[0], full_bufpos);
+			full_bufpos = 0;
+			gap -= block;
+		}
+
+		render_cw(text, f, s);
+		write_audio(dsp_fd, &full_buf[0], full_bufpos);
+		flush_audio(dsp_fd);
+		idle = 0;
+
+		pthread_mutex_lock(&streamlock);
+		stream_sent++;
+		if (stream_sent >= stream_wait) {
+			sending_complete = 1;
+		}
+		pthread_cond_signal(&streamcond);
+		pthread_mutex_unlock(&streamlock);
+	}
+	return NULL;
+}
+
+/* Queue 'text' at the current freq and speed into the continuous stream,
+ * starting the stream thread if needed. Returns the sequence number of
+ * the text, to be used with stream_await(). */
+
+static unsigned long stream_queue (char *text) {
+	unsigned long seq;
+	int j;
+
+	if (!stream_running) {
+		wait_cw();		/* the stream takes over the audio device */
+		j = pthread_create(&streamthread, NULL, &cwstream, NULL);
+		thread_fail(j);
+		stream_running = 1;
+	}
+
+	/* queue full? wait for the stream to catch up */
+	pthread_mutex_lock(&streamlock);
+	while (stream_queued - stream_sent >= STREAMQ) {
+		pthread_cond_wait(&streamcond, &streamlock);
+	}
+	strncpy(streamq[stream_queued % STREAMQ], text, 79);
+	streamq[stream_queued % STREAMQ][79] = '\0';
+	streamq_freq[stream_queued % STREAMQ] = freq;
+	streamq_speed[stream_queued % STREAMQ] = speed;
+	seq = ++stream_queued;
+	pthread_mutex_unlock(&streamlock);
+
+	return seq;
+}
+
+/* sending_complete will be set once text nr. 'seq' has left the stream */
+
+static void stream_await (unsigned long seq) {
+	pthread_mutex_lock(&streamlock);
+	stream_wait = seq;
+	sending_complete = (stream_sent >= seq);
+	pthread_mutex_unlock(&streamlock);
+}
+
+#endif
+
+/* send_cw starts the CW output of 'text' in the background, with the
+ * current freq and speed. A previous output is finished first. */
+
+static void send_cw (char *text) {
+#ifndef WIN_THREADS
+	int j;
+	if (continuous || stream_running) {
+		stream_queue(text);
+		return;
+	}
+#endif
+	wait_cw();
+#ifdef WIN_THREADS
+	cwthread = (HANDLE) _beginthread( morse,0,text);
+#else
+	j = pthread_create(&cwthread, NULL, &morse, (void *) text);	
+	thread_fail(j);
+#endif
+	cwthread_live = 1;
+}
+
+/* wait until all CW output is finished */
+
+static void wait_cw () {
+#ifndef WIN_THREADS
+	if (stream_running) {
+		pthread_mutex_lock(&streamlock);
+		while (stream_sent < stream_queued) {
+			pthread_cond_wait(&streamcond, &streamlock);
+		}
+		pthread_mutex_unlock(&streamlock);
+		return;
+	}
+#endif
+	if (!cwthread_live) {
+		return;
+	}
+#ifdef WIN_THREADS
+	WaitForSingleObject(cwthread,INFINITE);
+#else
+	pthread_join(cwthread, NULL);
+#endif
+	cwthread_live = 0;
+}
+
+static int add_to_buf(void* data, int size)
+{
+	memcpy(&full_buf[full_bufpos / sizeof(int)], data, size);
+	full_bufpos += size;
+	return 0;
+}	
+
+/* tonegen generates a sinus tone of frequency 'freq' and length 'len'
+ * (samples) based on 'samplerate', 'edge' (rise/falltime), followed by 'gap'
+ * samples of silence. The tone starts at the current (fractional) position
+ * sig_phase, the fall time reaches into the gap. Lengths don't have to be
+ * whole samples: the edges are computed at the exact times, and the rest
+ * is carried over to the next call in sig_phase, so timing errors never
+ * add up. */
+
+static int tonegen (int freq, double len, double gap, int waveform) {
+	int x, n;
+	double t, val=0;
+
+	/* number of samples until the next element starts */
+	n = (int) ceil(len + gap - sig_phase);
+	if (n < 0) {
+		n = 0;
+	}
+
+	for (x=0; x < n; x++) {
+		t = x + sig_phase;		/* exact time since the start of the tone */
+
+		if (freq == 0 || t >= len + ed) {
+			val = 0;
+		}
+		else {
+			switch (waveform) {
+				case SINE:
+					val = sin(2*PI*freq*t/samplerate);
+					break;
+				case SAWTOOTH:
+					val=((1.0*freq*t/samplerate)-floor(1.0*freq*t/samplerate))-0.5;
+					break;
+				case SQUARE:
+					val = ceil(sin(2*PI*freq*t/samplerate))-0.5;
+					break;
+				case SILENCE:
+					val = 0;
+			}
+
+			if (t < ed) { val *= pow(sin(PI*t/(2.0*ed)),2); }	/* rising edge */
+
+			if (t > len) {									/* falling edge */
+					val *= pow(cos(PI*(t-len)/(2.0*ed)),2); 
+			}
+		}
+		
+		if (sig_len < 882000) {
+			sig_buf[sig_len++] = (float) val;
+		}
+	}
+	sig_phase += n - (len + gap);
+	return 0;
+}
+
+/* add_signal converts the mono signal in sig_buf to output samples in
+ * full_buf and empties sig_buf */
+
+static void add_signal () {
+	int i, out;
+	int *o = &full_buf[full_bufpos / sizeof(int)];
+
+	if (sig_len > 882000 - full_bufpos / sizeof(int)) {
+		sig_len = 882000 - full_bufpos / sizeof(int);
+	}
+
+	channel(sig_buf, sig_len, 0);
+
+	for (i = 0; i < sig_len; i++) {
+		out = (int) (sig_buf[i] * 32500.0f);
+		out = out > 32767 ? 32767 : (out < -32767 ? -32767 : out);
+#ifndef PA
+		out = (out & 0xffff) | (int) ((unsigned) out << 16);	
+				/* stereo only for OSS & CoreAudio*/
+#endif
+		o[i] = out;
+	}
+	full_bufpos += sig_len * sizeof(int);
+	sig_len = 0;
+}
+
+/* add_stereo puts 'len' samples of a left and right channel into full_buf,
+ * clipped to the 16 bit range. PulseAudio is mono and gets the sum. */
+
+static void add_stereo (float *l, float *r, int len) {
+	int i, left, right;
+	int *o = &full_buf[full_bufpos / sizeof(int)];
+
+	if (len > 882000 - full_bufpos / sizeof(int)) {
+		len = 882000 - full_bufpos / sizeof(int);
+	}
+
+	channel(l, len, 0);
+	channel(r, len, 1);
+
+	for (i = 0; i < len; i++) {
+		left = (int) (l[i] * 32500.0f);
+		right = (int) (r[i] * 32500.0f);
+		left = left > 32767 ? 32767 : (left < -32767 ? -32767 : left);
+		right = right > 32767 ? 32767 : (right < -32767 ? -32767 : right);
+#ifdef PA
+		o[i] = (left + right) / 2;
+#else
+		o[i] = (left & 0xffff) | (int) ((unsigned) right << 16);
+#endif
+	}
+	full_bufpos += len * sizeof(int);
+}
+
+/* gauss returns a normally distributed random number (Box-Muller) */
+
+static double gauss () {
+	double u1, u2;
+	do {
+		u1 = rng_double(&rng_chan);
+	} while (u1 == 0);
+	u2 = rng_double(&rng_chan);
+	return sqrt(-2.0*log(u1)) * cos(2*PI*u2);
+}
+
+/* make_noisetab fills the noise table once with white noise, band limited
+ * to about 300..3000 Hz like a CW/SSB receiver, normalized to rms = 1. The
+ * channel simulator then only has to add table values. */
+
+static void make_noisetab () {
+	int i;
+	double hp = 0, lp1 = 0, lp2 = 0, x, prev = 0, sum = 0;
+	double ahp = exp(-2*PI*300.0/samplerate);		/* high pass 300 Hz */
+	double alp = exp(-2*PI*3000.0/samplerate);		/* low pass 3000 Hz */
+
+	if ((noisetab = malloc(NOISETAB * sizeof(float))) == NULL) {
+		fprintf(stderr, "Error: Couldn't allocate %d bytes!\n",
+						(int) (NOISETAB * sizeof(float)));
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < NOISETAB; i++) {
+		x = gauss();
+		hp = ahp * (hp + x - prev);
+		prev = x;
+		lp1 = (1-alp) * hp + alp * lp1;
+		lp2 = (1-alp) * lp1 + alp * lp2;
+		noisetab[i] = (float) lp2;
+		sum += lp2 * lp2;
+	}
+
+	sum = sqrt(sum / NOISETAB);
+	for (i = 0; i < NOISETAB; i++) {
+		noisetab[i] /= sum;
+	}
+}
+
+/* fading applies slow QSB to a signal: the gain is the magnitude of a
+ * complex gaussian process, low pass filtered to a fraction of a Hz
+ * (Rayleigh fading), plus a small steady part so the signal doesn't
+ * disappear completely for long. It's updated every 256 samples and
+ * interpolated in between. */
+
+static void fading (float *sig, int len) {
+	int i, n;
+	float g, dg;
+	double a = exp(-2*PI*0.15*256/samplerate);
+	double b = sqrt((1-a*a)/2);
+
+	if (!qsb) {
+		return;
+	}
+
+	while (len > 0) {
+		chst.qsbre = a * chst.qsbre + b * gauss();
+		chst.qsbim = a * chst.qsbim + b * gauss();
+		g = (float) (sqrt((0.3 + chst.qsbre) * (0.3 + chst.qsbre) + 
+						chst.qsbim * chst.qsbim) / 1.04);
+		n = len < 256 ? len : 256;
+		dg = (g - chst.qsbgain) / n;
+		for (i = 0; i < n; i++) {
+			sig[i] *= chst.qsbgain + i * dg;
+		}
+		chst.qsbgain = g;
+		sig += n;
+		len -= n;
+	}
+}
+
+/* add_scaled adds 'g' times s to d; vectorized by the compiler */
+
+static void add_scaled (float * restrict d, const float * restrict s, int len,
+				float g) {
+	int i;
+	for (i = 0; i < len; i++) {
+		d[i] += g * s[i];
+	}
+}
+
+/* channel adds noise at the configured SNR, an interfering carrier and
+ * static crashes to a signal. For stereo, channel 1 is called right after
+ * channel 0 with the same length and gets the same QRM and QRN, but
+ * independent noise. */
+
+static void channel (float *sig, int len, int ch) {
+	static struct channel_state ch0;
+	int i, n, pos;
+	float nscale;
+	double c;
+
+	if (!(noise || qrm || qrn) || len <= 0) {
+		return;
+	}
+
+	if (noisetab == NULL) {
+		make_noisetab();
+	}
+
+	if (ch == 0) {
+		ch0 = chst;
+	}
+	else {			/* replay QRM and QRN of channel 0 */
+		chst = ch0;
+		chst.pos = (chst.pos + NOISETAB/2) % NOISETAB;
+	}
+
+	/* noise: signal rms is 0.707 (sine, amplitude 1) */
+	if (noise) {
+		nscale = (float) (0.707 / pow(10, snr/20.0));
+		pos = chst.pos;
+		for (i = 0; i < len; i += n) {
+			n = NOISETAB - pos;
+			n = (n < len - i) ? n : len - i;
+			add_scaled(sig + i, noisetab + pos, n, nscale);
+			pos = (pos + n) % NOISETAB;
+		}
+	}
+	chst.pos = (chst.pos + len) % NOISETAB;
+
+	/* QRM: a steady carrier 150..400 Hz from the CW tone. The oscillator
+	 * is a complex phasor that is rotated once per block of QRMBLOCK
+	 * samples, the samples within a block come from a table. */
+	if (qrm) {
+		if (qrmtab == NULL) {
+			make_qrmtab(freq);
+		}
+		for (i = 0; i < len; i += n) {
+			n = (len - i < QRMBLOCK) ? len - i : QRMBLOCK;
+			qrm_block(sig + i, n, (float) chst.qrmc, (float) chst.qrms);
+			c = chst.qrmc * chst.qrmrc - chst.qrms * chst.qrmrs;
+			chst.qrms = chst.qrmc * chst.qrmrs + chst.qrms * chst.qrmrc;
+			chst.qrmc = c;
+		}
+		/* keep the oscillator from drifting in amplitude */
+		c = sqrt(chst.qrmc * chst.qrmc + chst.qrms * chst.qrms);
+		chst.qrmc /= c;
+		chst.qrms /= c;
+	}
+
+	/* QRN: static crashes, on average one every two seconds; noise
+	 * bursts with an exponential decay of ~50ms. Only the samples during
+	 * a crash are touched. */
+	if (qrn) {
+		float decay = (float) exp(-1.0/(0.05*samplerate));
+		pos = (chst.pos + NOISETAB/4) % NOISETAB;
+		i = 0;
+		while (i < len) {
+			if (chst.qrnnext <= 0) {	/* new crash */
+				chst.qrnamp = (float) (0.3 + 0.7*rng_double(&rng_chan));
+				chst.qrnnext = (long) (-2.0*samplerate*
+								log(1.0 - rng_double(&rng_chan)));
+			}
+			n = len - i;
+			if (n > chst.qrnnext) {
+				n = chst.qrnnext;
+			}
+			if (chst.qrnamp > 0.001f) {
+				if (n > NOISETAB - pos) {
+					n = NOISETAB - pos;
+				}
+				chst.qrnamp = add_decaying(sig + i, noisetab + pos, n, 
+								chst.qrnamp, decay);
+			}
+			pos = (pos + n) % NOISETAB;
+			chst.qrnnext -= n;
+			i += n;
+		}
+	}
+}
+
+/* make_qrmtab: cos and sin of the QRM carrier for one block, at a fixed
+ * offset from the CW pitch 'pitch'. render_cw makes it again whenever the
+ * pitch changes. */
+
+static void make_qrmtab (int pitch) {
+	int i;
+	double w;
+
+	if (qrmoffset == 0) {
+		qrmoffset = 150 + 250.0*rng_double(&rng_chan);
+	}
+	qrmpitch = pitch;
+	w = 2*PI*(pitch + qrmoffset)/samplerate;
+
+	if (qrmtab == NULL && 
+			(qrmtab = malloc(2 * QRMBLOCK * sizeof(float))) == NULL) {
+		fprintf(stderr, "Error: Couldn't allocate %d bytes!\n",
+						(int) (2 * QRMBLOCK * sizeof(float)));
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < QRMBLOCK; i++) {
+		qrmtab[i] = (float) cos(w*i);
+		qrmtab[QRMBLOCK + i] = (float) sin(w*i);
+	}
+	chst.qrmrc = cos(w*QRMBLOCK);
+	chst.qrmrs = sin(w*QRMBLOCK);
+}
+
+/* qrm_block adds the carrier with start phasor (c, s) to 'len' samples */
+
+static void qrm_block (float * restrict sig, int len, float c, float s) {
+	int i;
+	const float * restrict tc = qrmtab, * restrict ts = qrmtab + QRMBLOCK;
+	for (i = 0; i < len; i++) {
+		sig[i] += 0.25f * (s * tc[i] + c * ts[i]);
+	}
+}
+
+/* add_decaying adds s, starting at amplitude 'a' and decaying by 'decay'
+ * per sample, to d. Returns the amplitude after the last sample. */
+
+static float add_decaying (float * restrict d, const float * restrict s,
+				int len, float a, float decay) {
+	int i;
+	for (i = 0; i < len; i++) {
+		d[i] += a * s[i];
+		a *= decay;
+	}
+	return a;
+}
+
+/* Save config file
+ *
+ * Tries to keep the old format (including comments, etc.) and adds
+ * config options that were not used yet in the file to the end 
+ * */
+
+static int save_config () {
+	FILE *fh;
+	char tmp[80]="";
+	char tmpname[PATH_MAX+16];
+	char confopts[22][80] = {
+		"\ncallsign=", 
+		"\ncallbase=",
+		"\ndspdevice=", 
+		"\ninitialspeed=", 
+		"\nmincharspeed=",
+		"\nwaveform=", 
+		"\nconstanttone=",
+		"\nctonefreq=", 
+		"\nfixspeed=", 
+		"\nunlimitedattempt=", 
+		"\nf6=", 
+		"\nrisetime=", 
+		"\ncontinuous=", 
+		"\ncallgap=", 
+		"\npileup=", 
+		"\nnoise=", 
+		"\nsnr=", 
+		"\nqsb=", 
+		"\nqrm=", 
+		"\nqrn=", 
+		"\nadaptive=", 
+		"\nfilter=" 
+	};
+	char *conf1;
+	char *conf2;
+	char *find, *findend;
+	int i, len, conf1len, conf2len;
+	int j;
+
+	conf2 = malloc(1);
+
+	if ((fh = fopen(rcfilename, "rb")) == NULL) {
+		endwin();
+		fprintf(stderr, "Unable to open config file '%s'!\n", rcfilename);
+		exit(EXIT_FAILURE);
+	}
+
+	fseek(fh, 0, SEEK_END);
+	j = (int) ftell(fh);
+	conf1 = malloc((size_t) j+1);
+
+	rewind(fh);
+	i = fread(conf1, sizeof(char), (size_t) j, fh);
+	conf1[j] = '\0';
+	conf1len = j;
+
+	fclose(fh);
+
+	/* The whole config file is now in conf1 
+	 *
+	 * For each config option, search&replace it with the current value.
+	 * Only accept key=value pairs if the key starts on pos 0 of the line
+	 * */
+
+	//endwin();
+	for (i = 0; i < 22; i++) {
+		/* assemble new string for this conf option*/
+		switch (i) {
+			case 0:
+				sprintf(tmp, "%s%s", confopts[i], mycall);
+				break;
+			case 1:
+				sprintf(tmp, "%s%s", confopts[i], cbfilename);
+				break;
+			case 2:
+				sprintf(tmp, "%s%s", confopts[i], dspdevice);
+				break;
+			case 3:
+				sprintf(tmp, "%s%d", confopts[i], initialspeed);
+				break;
+			case 4:
+				sprintf(tmp, "%s%d", confopts[i], mincharspeed);
+				break;
+			case 5:
+				sprintf(tmp, "%s%d", confopts[i], waveform);
+				break;
+			case 6:
+				sprintf(tmp, "%s%d", confopts[i], constanttone);
+				break;
+			case 7:
+				sprintf(tmp, "%s%d", confopts[i], ctonefreq);
+				break;
+			case 8:
+				sprintf(tmp, "%s%d", confopts[i], fixspeed);
+				break;
+			case 9:
+				sprintf(tmp, "%s%d", confopts[i], unlimitedattempt);
+				break;
+			case 10:
+				sprintf(tmp, "%s%d", confopts[i], f6);
+				break;
+			case 11:
+				sprintf(tmp, "%s%f", confopts[i], edge);
+				break;
+			case 12:
+				sprintf(tmp, "%s%d", confopts[i], continuous);
+				break;
+			case 13:
+				sprintf(tmp, "%s%d", confopts[i], callgap);
+				break;
+			case 14:
+				sprintf(tmp, "%s%d", confopts[i], pileup);
+				break;
+			case 15:
+				sprintf(tmp, "%s%d", confopts[i], noise);
+				break;
+			case 16:
+				sprintf(tmp, "%s%d", confopts[i], snr);
+				break;
+			case 17:
+				sprintf(tmp, "%s%d", confopts[i], qsb);
+				break;
+			case 18:
+				sprintf(tmp, "%s%d", confopts[i], qrm);
+				break;
+			case 19:
+				sprintf(tmp, "%s%d", confopts[i], qrn);
+				break;
+			case 20:
+				sprintf(tmp, "%s%d", confopts[i], adaptive);
+				break;
+			case 21:
+				sprintf(tmp, "%s%s", confopts[i], cbfilter);
+				break;
+		}	
+
+		/* Conf option already in rc-file? */
+		if ((find = strstr(conf1, confopts[i])) != NULL) {
+			/* determine length. */
+			findend = find;
+			findend++;	/* starts with \n, always skip it */
+			/* up to the end of the value, the line end stays */
+			while (*findend && !isspace(*findend)) {
+				findend++;
+			}
+			len = findend - find;
+			
+			/* old size of conf1: conf1len (see above) 
+			 * new size: conf1len - len + strlen(tmp)*/
+			conf2len = conf1len - len + strlen(tmp);
+			conf2 = realloc(conf2, (size_t) conf2len);
+			memcpy(conf2, conf1, (find - conf1));
+			memcpy(conf2 + (find - conf1), tmp, strlen(tmp));
+			memcpy(conf2 + (find - conf1) + strlen(tmp), findend, 
+					(size_t) conf2len - (find - conf1) - strlen(tmp));
+		}
+		/* otherwise, add to the end */
+		else {
+			/* CR LF or LF only? */
+			if (strstr(conf1, "\r")) {
+				strcat(tmp, "\r");
+			}
+			strcat(tmp, "\n");
+			conf2len = conf1len + strlen(tmp) - 1;
+			conf2 = realloc(conf2, conf2len);
+			memcpy(conf2, conf1, conf1len-1);  // excl. \0
+			memcpy(conf2 + conf1len - 1, tmp, strlen(tmp)); // (incl. \0)
+		}
+		conf1 = realloc(conf1, (size_t) conf2len);
+		conf1len = conf2len;
+		if (conf1 == NULL) {
+			exit(0);
+		}
+		memcpy(conf1, conf2, conf1len);
+	}
+
+	/* replace the file atomically, the old one stays if anything fails */
+	if ((fh = open_replace(rcfilename, tmpname)) != NULL &&
+			fwrite(conf1, conf1len, sizeof(char), fh) != 1) {
+		fclose(fh);
+		remove(tmpname);
+		fh = NULL;
+	}
+	if (fh == NULL || commit_replace(fh, tmpname, rcfilename)) {
+		endwin();
+		fprintf(stderr, "Unable to write config file '%s'!\n", rcfilename);
+		exit(EXIT_FAILURE);
+	}
+
+	free(conf1);
+	free(conf2);
+
+	return 0;
+}
+		
+static void thread_fail (int j) {
+	if (j) {
+		endwin();
+		perror("Error: Unable to create cwthread!\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Add timestamps to toplist file if not there yet */
+static int check_toplist () {
+	char line[80]="";
+	char tmp[80]="";
+	FILE *fh;
+	FILE *fh2;
+
+	if ((fh = fopen(tlfilename, "r+")) == NULL) {
+		endwin();
+		perror("Unable to open toplist file 'toplist'!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fgets(tmp, 35, fh);
+	
+	rewind(fh);
+	
+	if (strlen(tmp) == 21) {
+			printw("Toplist file in old format. Converting...");
+			strcpy(tmp, "cp -f ");
+			strcat(tmp, tlfilename);
+			strcat(tmp, " /tmp/qrq-toplist");
+			if (system(tmp)) {
 					printw("Failed to copy to /tmp/qrq-toplist\n");
 					getch();
 					endwin();
 					exit(EXIT_FAILURE);
 			}
 
-			fh2 = fopen("/tmp/qrq-toplist", "r+"); 		/* should work ... */
+			fh2 = fopen("/tmp/qrq-toplist", "r+"); 		/* should work ... */
+
+			while ((feof(fh2) == 0) && (fgets(line, 35, fh2) != NULL)) {
+					line[20]=' ';
+					strcpy(tmp, line);
+					strcat(tmp, "1181234567\n");
+					fputs(tmp, fh);
+			}
+			
+			printw(" done!\n");
+	
+			fclose(fh2);
+
+	}
+
+	fclose(fh);
+
+	return 0;
+}
+
+
+
+/* See where our files are. We need 'callbase.qcb', 'qrqrc' and 'toplist'.
+ * The can be: 
+ * 1) In the current directory -> use them
+ * 2) In ~/.qrq/  -> use toplist and qrqrc from there and callbase from
+ *    DESTDIR/share/qrq/
+ * 3) in DESTDIR/share/qrq/ -> create ~/.qrq/ and copy qrqrc and toplist
+ *    there.
+ * 4) Nowhere --> Exit.*/
+static int find_files () {
+	
+	FILE *fh;
+	const char *homedir = NULL;
+	char tmp_rcfilename[1024] = "";
+	char tmp_tlfilename[1024] = "";
+	char tmp_cbfilename[1024] = "";
+
+	printw("\nChecking for necessary files (qrqrc, toplist, callbase)...\n");
+	
+	if (((fh = fopen("qrqrc", "r")) == NULL) ||
+		((fh = fopen("toplist", "r")) == NULL) ||
+		((fh = fopen("callbase.qcb", "r")) == NULL)) {
+		
+		if ((homedir = getenv("HOME")) != NULL) {
+		printw("... not found in current directory. Checking "
+						"%s/.qrq/...\n", homedir);
+		refresh();
+		strcat(rcfilename, homedir);
+		}
+		else {
+		printw("... not found in current directory. Checking "
+						"./.qrq/...\n", homedir);
+		refresh();
+		strcat(rcfilename, ".");
+		}
+				
+		strcat(rcfilename, "/.qrq/qrqrc");
+	
+		/* check if there is ~/.qrq/qrqrc. If it's there, it's safe to assume
+		 * that toplist also exists at the same place and callbase exists in
+		 * DESTDIR/share/qrq/. */
+
+		if ((fh = fopen(rcfilename, "r")) == NULL ) {
+			printw("... not found in %s/.qrq/. Checking %s/share/qrq..."
+							"\n", homedir, destdir);
+			/* check for the files in DESTDIR/share/qrq/. if exists, copy 
+			 * qrqrc and toplist to ~/.qrq/  */
+
+			strcpy(tmp_rcfilename, destdir);
+			strcat(tmp_rcfilename, "/share/qrq/qrqrc");
+			strcpy(tmp_tlfilename, destdir);
+			strcat(tmp_tlfilename, "/share/qrq/toplist");
+			strcpy(tmp_cbfilename, destdir);
+			strcat(tmp_cbfilename, "/share/qrq/callbase.qcb");
+
+			if (((fh = fopen(tmp_rcfilename, "r")) == NULL) ||
+				((fh = fopen(tmp_tlfilename, "r")) == NULL) ||
+				 ((fh = fopen(tmp_cbfilename, "r")) == NULL)) {
+				printw("Sorry: Couldn't find 'qrqrc', 'toplist' and"
+			   			" 'callbase.qcb' anywhere. Exit.\n");
+				getch();
+				endwin();
+				exit(EXIT_FAILURE);
+			}
+			else {			/* finally found it in DESTDIR/share/qrq/ ! */
+				/* abusing rcfilename here for something else temporarily */
+				printw("Found files in %s/share/qrq/."
+						"\nCreating directory %s/.qrq/ and copy qrqrc and"
+						" toplist there.\n", destdir, homedir);
+				strcpy(rcfilename, homedir);
+				strcat(rcfilename, "/.qrq/");
+#ifdef WIN32
+				j = mkdir(rcfilename);
+#else
+				j = mkdir(rcfilename,  0777);
+#endif
+				if (j && (errno != EEXIST)) {
+					printw("Failed to create %s! Exit.\n", rcfilename);
+					getch();
+					endwin();
+					exit(EXIT_FAILURE);
+				}
+				/* OK, now we created the directory, we can read in
+				 * DESTDIR/local/, so I assume copying files won't cause any
+				 * problem, with system()... */
+
+				strcpy(rcfilename, "install -m 644 ");
+				strcat(rcfilename, tmp_tlfilename);
+				strcat(rcfilename, " ");
+				strcat(rcfilename, homedir);
+				strcat(rcfilename, "/.qrq/ 2> /dev/null");
+				if (system(rcfilename)) {
+					printw("Failed to copy toplist file: %s\n", rcfilename);
+					getch();
+					endwin();
+					exit(EXIT_FAILURE);
+				}
+				strcpy(rcfilename, "install -m 644 ");
+				strcat(rcfilename, tmp_rcfilename);
+				strcat(rcfilename, " ");
+				strcat(rcfilename, homedir);
+				strcat(rcfilename, "/.qrq/ 2> /dev/null");
+				if (system(rcfilename)) {
+					printw("Failed to copy qrqrc file: %s\n", rcfilename);
+					getch();
+					endwin();
+					exit(EXIT_FAILURE);
+				}
+				printw("Files copied. You might want to edit "
+						"qrqrc according to your needs.\n", homedir);
+				strcpy(rcfilename, homedir);
+				strcat(rcfilename, "/.qrq/qrqrc");
+				strcpy(tlfilename, homedir);
+				strcat(tlfilename, "/.qrq/toplist");
+				strcpy(cbfilename, tmp_cbfilename);
+			} /* found in DESTDIR/share/qrq/ */
+		}
+		else {
+			printw("... found files in %s/.qrq/.\n", homedir);
+			strcat(tlfilename, homedir);
+			strcat(tlfilename, "/.qrq/toplist");
+			strcpy(cbfilename, destdir);
+			strcat(cbfilename, "/share/qrq/callbase.qcb");
+		}
+	}
+	else {
+		printw("... found in current directory.\n");
+		strcpy(rcfilename, "qrqrc");
+		strcpy(tlfilename, "toplist");
+		strcpy(cbfilename, "callbase.qcb");
+	}
+	refresh();
+	fclose(fh);
+	return 0;
+}
+
+
+/* statistics shows a chart of all scores of mycall (and their moving
+ * average) with best, average, trend and max. speed in mid_w. 's' saves
+ * the chart as SVG file next to the toplist. */
+
+static int statistics () {
+	char filename[PATH_MAX+16];
+	int i, k, n, x, y, c, from, to, max = 1;
+	int w = 48, h = 10;						/* size of the chart */
+
+	if (strcmp(stcall, mycall)) {
+		stats_build();
+	}
+	n = sthistnr;
+	for (i = 0; i < n; i++) {
+		if (sthist[i].score > max) {
+			max = sthist[i].score;
+		}
+	}
+
+	clear_display();
+	wattron(mid_w,A_BOLD);
+	mvwprintw(mid_w,1,2, "Statistics for %s", mycall);
+	wattroff(mid_w,A_BOLD);
+	mvwprintw(mid_w,2,2, "%d results, best %d, average of last %d: %d", n,
+					stbest, STAVG, stats_avg(n));
+	mvwprintw(mid_w,3,2, "Trend: %+.0f points/day, max. speed %d CpM", 
+					stats_trend(), stbestspeed);
+
+	/* y axis, then one column per result or group of results: their
+	 * best score as *, the moving average as - */
+	mvwprintw(mid_w,4,2, "%6d", max);
+	mvwprintw(mid_w,4+h-1,2, "%6d", 0);
+	for (y = 0; y < h; y++) {
+		mvwaddch(mid_w,4+y,9, ACS_VLINE);
+	}
+	for (x = 0; x < w && n; x++) {
+		from = (long) x * n / w;
+		to = (long) (x + 1) * n / w;
+		if (n < w) {
+			if (x >= n) {
+				break;
+			}
+			from = x;
+			to = x + 1;
+		}
+		if (from == to) {
+			continue;
+		}
+		for (k = 0, i = from; i < to; i++) {
+			if (sthist[i].score > k) {
+				k = sthist[i].score;
+			}
+		}
+		y = h - 1 - (int) ((long) stats_avg(to) * (h - 1) / max);
+		mvwaddch(mid_w,4+y,10+x, '-');
+		y = h - 1 - (int) ((long) k * (h - 1) / max);
+		mvwaddch(mid_w,4+y,10+x, '*');
+	}
+	mvwprintw(mid_w,15,2, "s: save as SVG, other keys: back");
+	wrefresh(mid_w);
+
+	c = wgetch(mid_w);
+	if (c == 's' || c == 'S') {
+		strcpy(filename, tlfilename);
+		sprintf(filename + strlen(filename) - strlen(basename(filename)),
+						"%s.svg", mycall);
+		for (i = strlen(filename) - 4 - strlen(mycall); filename[i]; i++) {
+			if (filename[i] == '/') {		/* portable calls */
+				filename[i] = '-';
+			}
+		}
+		mvwprintw(mid_w,15,2, "%-56s", stats_svg(filename) ? 
+				"Couldn't write the SVG file!" : basename(filename));
+		wrefresh(mid_w);
+		wgetch(mid_w);
+	}
+	return 0;
+}
+
+/* stats_build collects all results of mycall from the toplist (exact
+ * match) */
+
+static void stats_build () {
+	struct tlentry *e;
+	int i, j = 0, b = 0, n = 0;
+
+	strcpy(stcall, mycall);
+	sthistnr = 0;
+	for (i = 0; (e = tl_entry(i, &j, &b)); i++) {
+		if (strcmp(e->call, stcall)) {
+			continue;
+		}
+		if (n == sthistmax) {
+			sthistmax = sthistmax ? 2 * sthistmax : 256;
+			if ((sthist = realloc(sthist, sthistmax * 
+							sizeof(struct tlentry))) == NULL) {
+				fprintf(stderr, "Error: Couldn't allocate %d bytes!\n",
+						(int) (sthistmax * sizeof(struct tlentry)));
+				exit(EXIT_FAILURE);
+			}
+		}
+		sthist[n++] = *e;
+	}
+	qsort(sthist, n, sizeof(struct tlentry), stcompare);
+
+	stbest = stbestspeed = 0;
+	stsx = stsy = stsxx = stsxy = 0;
+	stfirst = n ? sthist[0].timestamp : 0;
+	for (i = 0; i < n; i++) {
+		stats_sum(&sthist[i]);
+	}
+	sthistnr = n;
+}
+
+/* stats_add adds a new result to the history and the sums */
+
+static void stats_add (const struct tlentry *e) {
+	int i;
+
+	if (sthistnr == sthistmax) {
+		sthistmax = sthistmax ? 2 * sthistmax : 256;
+		if ((sthist = realloc(sthist, sthistmax * 
+						sizeof(struct tlentry))) == NULL) {
+			fprintf(stderr, "Error: Couldn't allocate %d bytes!\n",
+					(int) (sthistmax * sizeof(struct tlentry)));
+			exit(EXIT_FAILURE);
+		}
+	}
+	/* usually the newest one, otherwise sorted in */
+	for (i = sthistnr; i > 0 && sthist[i-1].timestamp > e->timestamp; i--) {
+		sthist[i] = sthist[i-1];
+	}
+	sthist[i] = *e;
+	if (!sthistnr++) {
+		stfirst = e->timestamp;
+	}
+	stats_sum(e);
+}
+
+/* stats_sum adds a result to the best values and the sums for the trend */
+
+static void stats_sum (const struct tlentry *e) {
+	double x;
+
+	x = (e->timestamp - stfirst) / 86400.0;
+	stsx += x;
+	stsy += e->score;
+	stsxx += x * x;
+	stsxy += x * e->score;
+	if (e->score > stbest) {
+		stbest = e->score;
+	}
+	if (e->maxspeed > stbestspeed) {
+		stbestspeed = e->maxspeed;
+	}
+}
+
+/* stats_avg: average of the STAVG results before nr. 'k' */
+
+static int stats_avg (int k) {
+	int i, sum = 0;
+
+	for (i = (k > STAVG) ? k - STAVG : 0; i < k; i++) {
+		sum += sthist[i].score;
+	}
+	return (k > STAVG) ? sum / STAVG : (k ? sum / k : 0);
+}
+
+/* stats_trend: slope of the least squares line through the scores, in
+ * points per day */
+
+static double stats_trend () {
+	double n = sthistnr, d = n * stsxx - stsx * stsx;
+
+	return (n > 1 && d > 1e-9) ? (n * stsxy - stsx * stsy) / d : 0;
+}
+
+static int stcompare (const void *a, const void *b) {
+	const struct tlentry *x = a, *y = b;
+
+	return (x->timestamp > y->timestamp) - (x->timestamp < y->timestamp);
+}
+
+/* stats_svg writes the chart of the statistics as SVG: scores, moving
+ * average and max. speed (right axis) per result. Returns 0 if it worked. */
+
+static int stats_svg (const char *filename) {
+	FILE *fh;
+	char tmpname[PATH_MAX+16];
+	int i, n = sthistnr, max = 1, maxs = 1;
+	double dx;
+
+	for (i = 0; i < n; i++) {
+		if (sthist[i].score > max) {
+			max = sthist[i].score;
+		}
+		if (sthist[i].maxspeed > maxs) {
+			maxs = sthist[i].maxspeed;
+		}
+	}
+	dx = n > 1 ? 700.0 / (n - 1) : 0;
+
+	if ((fh = open_replace(filename, tmpname)) == NULL) {
+		return -1;
+	}
+	fprintf(fh, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"800\" "
+				"height=\"400\" font-family=\"sans-serif\" font-size=\"12\">\n"
+				"<rect width=\"800\" height=\"400\" fill=\"white\"/>\n"
+				"<text x=\"50\" y=\"20\" font-size=\"16\">QRQ scores for %s "
+				"(best %d, trend %+.0f/day)</text>\n"
+				"<path d=\"M50 50 V350 H750 V50\" fill=\"none\" "
+				"stroke=\"black\"/>\n"
+				"<text x=\"45\" y=\"55\" text-anchor=\"end\">%d</text>\n"
+				"<text x=\"45\" y=\"355\" text-anchor=\"end\">0</text>\n"
+				"<text x=\"755\" y=\"55\">%d CpM</text>\n",
+				mycall, stbest, stats_trend(), max, maxs);
+
+	fprintf(fh, "<polyline fill=\"none\" stroke=\"#c00\" points=\"");
+	for (i = 0; i < n; i++) {
+		fprintf(fh, "%.1f,%.1f ", 50 + i * dx, 
+						350 - 300.0 * sthist[i].maxspeed / maxs);
+	}
+	fprintf(fh, "\"/>\n<polyline fill=\"none\" stroke=\"#888\" points=\"");
+	for (i = 0; i < n; i++) {
+		fprintf(fh, "%.1f,%.1f ", 50 + i * dx, 
+						350 - 300.0 * stats_avg(i + 1) / max);
+	}
+	fprintf(fh, "\"/>\n<polyline fill=\"none\" stroke=\"#00c\" points=\"");
+	for (i = 0; i < n; i++) {
+		fprintf(fh, "%.1f,%.1f ", 50 + i * dx, 
+						350 - 300.0 * sthist[i].score / max);
+	}
+	fprintf(fh, "\"/>\n<text x=\"50\" y=\"375\" fill=\"#00c\">score</text>"
+				"<text x=\"110\" y=\"375\" fill=\"#888\">average of %d</text>"
+				"<text x=\"220\" y=\"375\" fill=\"#c00\">max. speed</text>\n"
+				"</svg>\n", STAVG);
+
+	return commit_replace(fh, tmpname, filename);
+}
+
+
+/* read_callbase reads the callbase file with one sequential read into the
+ * arena, converts it to upper case and builds the offset index in place */
+
+int read_callbase () {
+	FILE *fh;
+	long size;
+	int i, j, len, nr=0;
+	char *p, *line;
+
+	if ((fh = fopen(cbfilename, "rb")) == NULL ||
+				fseek(fh, 0, SEEK_END) || (size = ftell(fh)) < 0) {
+		snprintf(cberror, sizeof(cberror), "Error: Couldn't read callsign "
+						"database ('%s')!", cbfilename);
+		if (fh) {
+			fclose(fh);
+		}
+		return -1;
+	}
+	rewind(fh);
+
+	free_callbase();
+	cbgen++;
+
+	if ((nr = map_callbase(fh))) {
+		fclose(fh);
+		if (nr > 0 && (cbperm = malloc(2 * nr * sizeof(uint32_t))) == NULL) {
+			snprintf(cberror, sizeof(cberror), "Error: Couldn't allocate %d "
+							"bytes!", (int) (2 * nr * sizeof(uint32_t)));
+			free_callbase();
+			return -1;
+		}
+		return nr;
+	}
+	rewind(fh);
+
+	/* one byte more for a newline behind the last line */
+	if ((cbarena = malloc(size + 1)) == NULL) {
+		snprintf(cberror, sizeof(cberror), "Error: Couldn't allocate %ld "
+						"bytes!", size + 1);
+		fclose(fh);
+		return -1;
+	}
+	/* in pieces, for the progress display */
+	cbloadsize = size;
+	for (cbloaddone = 0; cbloaddone < size; cbloaddone += i) {
+		i = fread(cbarena + cbloaddone, 1, 
+				(size - cbloaddone < (1 << 20)) ? size - cbloaddone : 1 << 20, fh);
+		if (i <= 0) {
+			break;
+		}
+	}
+	size = cbloaddone;
+	fclose(fh);
+	cbarena[size] = '\n';
+
+	/* count the lines/calls */
+	for (i = 0; i < size; i++) {
+		if (cbarena[i] == '\n') {
+			nr++;
+		}
+	}
+	if (size && cbarena[size-1] != '\n') {
+		nr++;
+	}
+
+	if (!nr) {
+		strcpy(cberror, "Error: Callsign database empty, no calls read.");
+		free_callbase();
+		return -1;
+	}
+
+	if ((cboffs = malloc(nr * sizeof(uint32_t))) == NULL ||
+					(cbperm = malloc(2 * nr * sizeof(uint32_t))) == NULL) {
+		snprintf(cberror, sizeof(cberror), "Error: Couldn't allocate %d "
+						"bytes!", (int) (3 * nr * sizeof(uint32_t)));
+		free_callbase();
+		return -1;
+	}
+
+	/* terminate the lines in place */
+	line = cbarena;
+	for (i = 0; i < nr; i++) {
+		p = memchr(line, '\n', cbarena + size + 1 - line);
+		len = p - line;
+		if (len && line[len-1] == '\r') {		/* also for DOS files */
+			len--;
+		}
+		if (len > CBMAXLEN) {
+			len = CBMAXLEN;
+		}
+		line[len] = '\0';
+		for (j = 0; j < len; j++) {
+			line[j] = toupper(line[j]);
+		}
+		cboffs[i] = line - cbarena;
+		line = p + 1;
+	}
+
+	if (size > FCTHRESHOLD) {
+		front_code(nr);
+	}
+
+	return nr;
+}
+
+/* front_code converts the callbase read into cbarena to the front coded
+ * form, if that saves at least a third of the memory */
+
+static void front_code (int nr) {
+	size_t size = 0, arena = 0;
+	unsigned char *d;
+	char *c, *prev = "";
+	int i, k, len;
+
+	for (i = 0; i < nr; i++) {
+		c = cb_call(i);
+		len = strlen(c);
+		arena += len + 1;
+		if (i % FCBLOCK) {
+			for (k = 0; c[k] && c[k] == prev[k]; k++)
+				;
+			size += 1 + len - k + 1;
+		}
+		else {
+			size += len + 1;
+		}
+		prev = c;
+	}
+
+	if (size + (nr / FCBLOCK + 1) * sizeof(uint32_t) > 
+					(arena + nr * sizeof(uint32_t)) * 2 / 3) {
+		return;
+	}
+
+	if ((fcdata = malloc(size)) == NULL ||
+		(fcblocks = malloc((nr / FCBLOCK + 1) * sizeof(uint32_t))) == NULL) {
+		free(fcdata);					/* keep it as it is */
+		fcdata = NULL;
+		return;
+	}
+
+	d = fcdata;
+	prev = "";
+	for (i = 0; i < nr; i++) {
+		c = cbarena + cboffs[i];
+		if (i % FCBLOCK) {
+			for (k = 0; c[k] && c[k] == prev[k]; k++)
+				;
+			*d++ = k;
+		}
+		else {
+			fcblocks[i / FCBLOCK] = d - fcdata;
+			k = 0;
+		}
+		len = strlen(c + k) + 1;
+		memcpy(d, c + k, len);
+		d += len;
+		prev = c;
+	}
+
+	free(cbarena);
+	free(cboffs);
+	cbarena = NULL;
+	cboffs = NULL;
+}
+
+/* load_callbase reads the callbase 'cbfilename', unless it's already
+ * loaded and the file didn't change since (same inode, mtime and size) */
+
+static int load_callbase () {
+	struct stat st;
+	int n, nr;
+
+	if (!strcmp(cbfilename, GENCALLBASE)) {
+		if (!cbgenerated) {
+			free_callbase();
+			cbgen++;
+			cbloaded[0] = '\0';
+			cbgenerated = 1;
+		}
+		nrofcalls = cbtotal = GENCALLS;
+		reset_calls();
+		return nrofcalls;
+	}
+
+	if (streamcallbase) {
+		n = (unlimitedattempt || adaptive) ? CBWINDOW : 50;
+		if (cbfresh && cbline && cbsample == n && !seed) {
+			cbfresh = 0;
+			reset_calls();
+			return nrofcalls;
+		}
+		cbfresh = 0;
+		if ((nr = sample_callbase(n)) < 0) {
+			return -1;
+		}
+		if (nr) {
+			reset_calls();
+			return nrofcalls;
+		}
+	}
+
+	if ((cbarena || fcdata) && !cbline && !strcmp(cbloaded, cbfilename) && 
+					!stat(cbfilename, &st) && st.st_ino == cbstat.st_ino &&
+					st.st_dev == cbstat.st_dev && 
+					st.st_mtime == cbstat.st_mtime && 
+					st.st_size == cbstat.st_size) {
+		return nrofcalls;
+	}
+
+	/* stat before reading, so a change while reading causes a reload */
+	if (stat(cbfilename, &cbstat)) {
+		memset(&cbstat, 0, sizeof(cbstat));
+	}
+	strcpy(cbloaded, cbfilename);
+	if ((nr = read_callbase()) < 0) {
+		cbloaded[0] = '\0';
+		return -1;
+	}
+	nrofcalls = cbtotal = nr;
+	reset_calls();
+	return nrofcalls;
+}
+
+/* start_callbase (re)loads the callbase in the background, so the user
+ * can already enter the call. wait_callbase waits for it, with a progress
+ * display if 'show' is set. Nothing else may touch the callbase in
+ * between. An error of the loader ends qrq in wait_callbase, as only the
+ * main thread may do that. */
+
+static void start_callbase () {
+#ifndef WIN_THREADS
+	int j;
+#endif
+
+	wait_callbase(0);
+	cbloadsize = cbloaddone = 0;
+	cbthread_done = 0;
+	cbfresh = 0;
+	cberror[0] = '\0';
+#ifdef WIN_THREADS
+	cbthread = (HANDLE) _beginthread(load_thread, 0, NULL);
+#else
+	j = pthread_create(&cbthread, NULL, &load_thread, NULL);
+	thread_fail(j);
+#endif
+	cbthread_live = 1;
+}
+
+static void wait_callbase (int show) {
+#ifndef WIN_THREADS
+	struct timespec ts;
+#endif
+
+	if (!cbthread_live) {
+		return;
+	}
+#ifdef WIN_THREADS
+	while (WaitForSingleObject(cbthread, show ? 100 : INFINITE) == 
+					WAIT_TIMEOUT) {
+		show_cbprogress();
+	}
+#else
+	pthread_mutex_lock(&cblock);
+	while (!cbthread_done) {
+		if (!show) {
+			pthread_cond_wait(&cbcond, &cblock);
+			continue;
+		}
+		pthread_mutex_unlock(&cblock);
+		show_cbprogress();
+		pthread_mutex_lock(&cblock);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		if ((ts.tv_nsec += 100000000) >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&cbcond, &cblock, &ts);
+	}
+	pthread_mutex_unlock(&cblock);
+	pthread_join(cbthread, NULL);
+#endif
+	cbthread_live = 0;
+	if (show) {
+		show_cbprogress();
+	}
+	if (cberror[0]) {
+		cbfail();
+	}
+}
+
+static void *load_thread (void *arg) {
+	cbfresh = (load_callbase() >= 0);
+#ifndef WIN_THREADS
+	pthread_mutex_lock(&cblock);
+	cbthread_done = 1;
+	pthread_cond_signal(&cbcond);
+	pthread_mutex_unlock(&cblock);
+#endif
+	return NULL;
+}
+
+/* cb_loading returns 1 while the background loader is busy */
+
+static int cb_loading () {
+	int busy;
+
+	if (!cbthread_live) {
+		return 0;
+	}
+#ifdef WIN_THREADS
+	busy = (WaitForSingleObject(cbthread, 0) == WAIT_TIMEOUT);
+#else
+	pthread_mutex_lock(&cblock);
+	busy = !cbthread_done;
+	pthread_mutex_unlock(&cblock);
+#endif
+	return busy;
+}
+
+/* cbfail ends qrq with the error of the last callbase load */
+
+static void cbfail () {
+	endwin();
+	fprintf(stderr, "%s\n", cberror);
+	exit(EXIT_FAILURE);
+}
+
+/* show_cbprogress shows how far the callbase is loaded (in the bottom line
+ * of mid_w), or removes that when it's done */
+
+static void show_cbprogress () {
+	if (!mid_w) {
+		return;
+	}
+	if (cb_loading()) {
+		mvwprintw(mid_w,15,2, "Loading callbase... %3d%%", cbloadsize ? 
+						(int) (100.0 * cbloaddone / cbloadsize) : 0);
+	}
+	else {
+		mvwprintw(mid_w,15,2, "                        ");
+	}
+	wrefresh(mid_w);
+}
+
+/* sample_callbase draws 'n' random calls from the callbase file in one
+ * pass (reservoir sampling, algorithm R), so only these have to be kept in
+ * memory. Returns 0 for .qcbx files, which are mapped anyway. */
+
+static int sample_callbase (int n) {
+	FILE *fh;
+	char line[256];
+	unsigned long nr = 0;
+	uint32_t j;
+	int i, len, cont = 0;
+	struct stat st;
+
+	if ((fh = fopen(cbfilename, "rb")) == NULL) {
+		snprintf(cberror, sizeof(cberror), "Error: Couldn't read callsign "
+						"database ('%s')!", cbfilename);
+		return -1;
+	}
+	if (fread(line, 4, 1, fh) == 1 && !memcmp(line, QCBX_MAGIC, 4)) {
+		fclose(fh);
+		return 0;
+	}
+	rewind(fh);
+
+	if (!fstat(fileno(fh), &st)) {
+		cbloadsize = st.st_size;
+	}
+
+	free_callbase();
+	cbgen++;
+	cbloaded[0] = '\0';
+	cbarena = malloc(n * (CBMAXLEN + 1));
+	cboffs = malloc(n * sizeof(uint32_t));
+	cbline = malloc(n * sizeof(uint32_t));
+	cbperm = malloc(2 * n * sizeof(uint32_t));
+	if (!cbarena || !cboffs || !cbline || !cbperm) {
+		snprintf(cberror, sizeof(cberror), "Error: Couldn't allocate %d "
+					"bytes!", (int) (n * (CBMAXLEN + 1 + 4 * sizeof(uint32_t))));
+		free_callbase();
+		fclose(fh);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fh) != NULL) {
+		len = strcspn(line, "\r\n");
+		if (cont) {					/* rest of an overlong line */
+			cont = (line[len] == '\0');
+			continue;
+		}
+		cont = (line[len] == '\0' && !feof(fh));
+
+		/* keep the first n calls, then replace a random one of the
+		 * sample with probability n/(nr+1) */
+		j = (nr < n) ? nr : rng_below(&rng_main, nr + 1);
+		if (j < n) {
+			if (len > CBMAXLEN) {
+				len = CBMAXLEN;
+			}
+			for (i = 0; i < len; i++) {
+				cbarena[j * (CBMAXLEN + 1) + i] = toupper(line[i]);
+			}
+			cbarena[j * (CBMAXLEN + 1) + len] = '\0';
+			cbline[j] = nr;
+		}
+		if (!(++nr % 65536)) {
+			cbloaddone = ftell(fh);
+		}
+	}
+	fclose(fh);
+
+	if (!nr) {
+		strcpy(cberror, "Error: Callsign database empty, no calls read.");
+		free_callbase();
+		return -1;
+	}
+
+	cbtotal = nr;
+	cbsample = n;
+	nrofcalls = (nr < n) ? nr : n;
+	for (i = 0; i < nrofcalls; i++) {
+		cboffs[i] = i * (CBMAXLEN + 1);
+	}
+	return nrofcalls;
+}
+
+/* map_callbase maps a compiled callbase (.qcbx) and sets up cbarena,
+ * cboffs to point into it. Returns the number of calls, or 0 if
+ * 'fh' isn't a .qcbx file. Windows gets a private copy instead of a map. */
+
+static int map_callbase (FILE *fh) {
+	struct qcbx_header h;
+	struct stat st;
+	size_t tabsize;
+	char *base;
+	int i;
+
+	if (fread(&h, sizeof(h), 1, fh) != 1 || 
+					memcmp(h.magic, QCBX_MAGIC, 4)) {
+		return 0;
+	}
+
+	tabsize = (size_t) h.nr * sizeof(uint32_t);
+	if (h.version != QCBX_VERSION || !h.nr || !h.strsize || 
+					fstat(fileno(fh), &st) ||
+					st.st_size != sizeof(h) + tabsize + h.strsize) {
+		snprintf(cberror, sizeof(cberror), "Error: Callsign database '%s' "
+						"is damaged or from another version of qrq!", cbfilename);
+		return -1;
+	}
+	cbmapsize = st.st_size;
+
+#ifndef WIN32
+	cbmap = mmap(NULL, cbmapsize, PROT_READ, MAP_SHARED, fileno(fh), 0);
+	if (cbmap == MAP_FAILED) {
+		cbmap = NULL;
+#else
+	rewind(fh);
+	if ((cbmap = malloc(cbmapsize)) == NULL || 
+					fread(cbmap, cbmapsize, 1, fh) != 1) {
+#endif
+		snprintf(cberror, sizeof(cberror), "Error: Couldn't read callsign "
+						"database ('%s')!", cbfilename);
+		free_callbase();
+		return -1;
+	}
+
+	base = (char *) cbmap + sizeof(h);
+	cboffs = (uint32_t *) base;
+	cbarena = base + tabsize;
+
+	/* never trust an offset that points out of the string area, or a
+	 * call longer than the buffers it's copied to */
+	if (cbarena[h.strsize - 1] != '\0') {
+		i = 0;
+	}
+	else {
+		for (i = 0; i < h.nr && cboffs[i] < h.strsize && 
+				strnlen(cbarena + cboffs[i], CBMAXLEN + 1) <= CBMAXLEN; i++)
+			;
+	}
+	if (i < h.nr) {
+		snprintf(cberror, sizeof(cberror), "Error: Callsign database '%s' "
+						"is damaged!", cbfilename);
+		free_callbase();
+		return -1;
+	}
+
+	return h.nr;
+}
+
+/* free_callbase releases the current callbase, mapped or read */
+
+static void free_callbase () {
+	if (cbmap) {
+#ifndef WIN32
+		munmap(cbmap, cbmapsize);
+#else
+		free(cbmap);
+#endif
+		cbmap = NULL;
+	}
+	else {
+		free(cbarena);
+		free(cboffs);
+	}
+	free(fcdata);
+	free(fcblocks);
+	fcdata = NULL;
+	fcblocks = NULL;
+	cbgenerated = 0;
+	free(cbperm);
+	free(cbline);
+	cbline = NULL;
+	free(cbsorted);
+	cbsorted = NULL;
+	cbarena = NULL;
+	cboffs = NULL;
+	cbperm = NULL;
+	cbinv = NULL;
+}
+
+/* cb_call returns call nr. 'i' of the callbase. Front coded calls are
+ * decoded from the start of their block (generated ones made) into one of
+ * four buffers, so the result stays valid for the next three cb_calls. */
+
+static char *cb_call (int i) {
+	static char buf[4][CBMAXLEN+1];
+	static int b = 0;
+	unsigned char *p;
+	char *c;
+	int k;
+
+	if (!fcdata && !cbgenerated) {
+		return cbarena + cboffs[i];
+	}
+
+	b = (b + 1) % 4;
+	c = buf[b];
+	if (cbgenerated) {
+		gen_call(i, c);
+		return c;
+	}
+	p = fcdata + fcblocks[i / FCBLOCK];
+	strcpy(c, (char *) p);
+	for (k = i % FCBLOCK; k > 0; k--) {
+		p += strlen((char *) p) + 1;
+		strcpy(c + *p, (char *) p + 1);
+		p++;
+	}
+	return c;
+}
+
+/* select an unused callsign from the callbase and copy it to 'call'. This
+ * is one step of a Fisher-Yates shuffle of cbperm: a random one of the
+ * unused calls is swapped to position cbpos, which then counts as used. */
+
+static int pick_call (char *call) {
+	int i = -1;
+
+	if (cbgenerated) {
+		return gen_pick(call);
+	}
+	if (cbpos >= cbactive) {		/* all used, start over ... */
+		if (cbline) {				/* ... with a new sample */
+			if (sample_callbase(nrofcalls) < 0) {
+				cbfail();
+			}
+			reset_calls();
+		}
+		cbpos = 0;
+	}
+	if (adaptive) {
+		i = adaptive_pick();
+	}
+	if (i < 0) {
+		i = cbperm[cbpos + rng_below(&rng_main, cbactive - cbpos)];
+	}
+	use_call(cbinv[i]);
+
+	strcpy(call, cb_call(i));
+	return i;
+}
+
+/* use_call moves the call at position 'j' of cbperm to the used ones */
+
+static void use_call (uint32_t j) {
+	uint32_t i = cbperm[j];
+
+	cbperm[j] = cbperm[cbpos];
+	cbinv[cbperm[j]] = j;
+	cbperm[cbpos] = i;
+	cbinv[i] = cbpos++;
+}
+
+/* reset_calls marks all calls unused, in callbase order, so the picks only
+ * depend on the seed */
+
+static void reset_calls () {
+	cbpos = 0;
+	if (cbgenerated) {
+		cbactive = cbavail = nrofcalls;
+		gen_key();
+		return;
+	}
+	cbinv = cbperm + nrofcalls;
+	if (!cbfilter[0] || !(cbactive = apply_filter())) {
+		for (cbactive = 0; cbactive < nrofcalls; cbactive++) {
+			cbperm[cbactive] = cbinv[cbactive] = cbactive;
+		}
+	}
+	/* a filtered sample of a streamed callbase: no idea how many match */
+	cbavail = (cbline || cbactive == nrofcalls) ? cbtotal : cbactive;
+	addirty = 1;
+}
+
+/* apply_filter puts all calls that match cbfilter at the start of cbperm
+ * and returns their number. Only the calls of the fitting prefix ranges
+ * or length groups of the index are looked at. */
+
+static int apply_filter () {
+	char globs[FILTERLEN+1], *g[FILTERLEN/2+1];
+	int ng, prefixes, minlen, maxlen, k, len;
+	uint32_t i, n = 0, lo, hi, mid, *cand, from, to;
+
+	build_cbindex();
+
+	strcpy(globs, cbfilter);
+	prefixes = parse_filter(globs, g, &ng, &minlen, &maxlen);
+
+	for (i = 0; i < nrofcalls; i++) {
+		cbinv[i] = UINT32_MAX;				/* not in the filter */
+	}
+
+	/* candidates: the sorted range of every prefix, or the length groups */
+	for (k = 0; k < (ng && prefixes ? ng : 1); k++) {
+		if (ng && prefixes) {
+			len = strlen(g[k]) - 1;
+			for (lo = 0, hi = nrofcalls; lo < hi; ) {	/* first >= prefix */
+				mid = lo + (hi - lo)/2;
+				if (strncmp(cb_call(cbsorted[mid]), g[k], len) < 0) {
+					lo = mid + 1;
+				}
+				else {
+					hi = mid;
+				}
+			}
+			cand = cbsorted;
+			from = lo;
+			for (to = lo; to < nrofcalls && 
+					!strncmp(cb_call(cbsorted[to]), g[k], len); to++)
+				;
+		}
+		else {
+			cand = cblenidx;
+			from = (minlen <= maxlen) ? cblenstart[minlen] : 0;
+			to = (minlen <= maxlen) ? cblenstart[maxlen+1] : 0;
+		}
+
+		for (; from < to; from++) {
+			i = cand[from];
+			if (cbinv[i] != UINT32_MAX || 
+					!match_filter(cb_call(i), g, ng, minlen, maxlen)) {
+				continue;
+			}
+			cbperm[n] = i;
+			cbinv[i] = n++;
+		}
+	}
+	return n;
+}
+
+/* parse_filter splits 'globs' (a copy of cbfilter) into the globs 'g' and
+ * the length range. Returns 1 if all globs are plain prefixes like DL* */
+
+static int parse_filter (char *globs, char **g, int *ng, int *minlen,
+				int *maxlen) {
+	int a, b, prefixes = 1;
+	char *t;
+
+	*ng = 0;
+	*minlen = 0;
+	*maxlen = CBMAXLEN;
+	for (t = strtok(globs, ","); t; t = strtok(NULL, ",")) {
+		if (sscanf(t, "%d-%d", &a, &b) == 2 && strspn(t, "0123456789-") == 
+						strlen(t)) {
+			*minlen = a;
+			*maxlen = b;
+		}
+		else if (strspn(t, "0123456789") == strlen(t)) {
+			*minlen = *maxlen = atoi(t);
+		}
+		else {
+			g[(*ng)++] = t;
+			/* prefix: only one *, at the end */
+			if (strcspn(t, "*?") != strlen(t) - 1 || t[strlen(t)-1] != '*') {
+				prefixes = 0;
+			}
+		}
+	}
+	if (*minlen < 0) {
+		*minlen = 0;
+	}
+	if (*maxlen > CBMAXLEN) {
+		*maxlen = CBMAXLEN;
+	}
+	return prefixes;
+}
+
+/* match_filter: is 'c' in the length range and does one of the globs
+ * match? */
+
+static int match_filter (const char *c, char **g, int ng, int minlen,
+				int maxlen) {
+	int a, len = strlen(c);
+
+	if (len < minlen || len > maxlen) {
+		return 0;
+	}
+	for (a = 0; a < ng && !glob_match(g[a], c); a++)
+		;
+	return !ng || a < ng;
+}
+
+/* build_cbindex sorts the calls once per callbase, by call and by length */
+
+static void build_cbindex () {
+	uint32_t i, n = nrofcalls;
+	int len;
+
+	if (cbidxgen == cbgen && cbsorted) {
+		return;
+	}
+	free(cbsorted);
+	if ((cbsorted = malloc(2 * n * sizeof(uint32_t))) == NULL) {
+		fprintf(stderr, "Error: Couldn't allocate %d bytes!\n", 
+						(int) (2 * n * sizeof(uint32_t)));
+		exit(EXIT_FAILURE);
+	}
+	cblenidx = cbsorted + n;
+
+	for (i = 0; i < n; i++) {
+		cbsorted[i] = i;
+	}
+	/* big lists are usually sorted already */
+	for (i = 1; i < n && strcmp(cb_call(i-1), cb_call(i)) <= 0; i++)
+		;
+	if (i < n) {
+		qsort(cbsorted, n, sizeof(uint32_t), cbcompare);
+	}
+
+	/* counting sort by length */
+	memset(cblenstart, 0, sizeof(cblenstart));
+	for (i = 0; i < n; i++) {
+		cblenstart[strlen(cb_call(i)) + 1]++;
+	}
+	for (len = 1; len < CBMAXLEN+2; len++) {
+		cblenstart[len] += cblenstart[len-1];
+	}
+	for (i = 0; i < n; i++) {
+		cblenidx[cblenstart[strlen(cb_call(i))]++] = i;
+	}
+	for (len = CBMAXLEN+1; len > 0; len--) {	/* back to the starts */
+		cblenstart[len] = cblenstart[len-1];
+	}
+	cblenstart[0] = 0;
+
+	cbidxgen = cbgen;
+}
+
+static int cbcompare (const void *a, const void *b) {
+	return strcmp(cb_call(*(const uint32_t *) a), 
+					cb_call(*(const uint32_t *) b));
+}
+
+/* glob_match: does 'str' match 'pat', with * and ? as wildcards? */
+
+static int glob_match (const char *pat, const char *str) {
+	const char *star = NULL, *back = NULL;
+
+	while (*str) {
+		if (*pat == '?' || *pat == *str) {
+			pat++;
+			str++;
+		}
+		else if (*pat == '*') {
+			star = pat++;
+			back = str;
+		}
+		else if (star) {
+			pat = star + 1;
+			str = ++back;
+		}
+		else {
+			return 0;
+		}
+	}
+	while (*pat == '*') {
+		pat++;
+	}
+	return !*pat;
+}
+
+/* char_stats counts the characters and pairs of characters of a call, and
+ * the wrong ones in 'input' */
+
+static void char_stats (char *realcall, char *input) {
+	int i, a, b, wrong, prevwrong = 0;
+	int inlen = strlen(input);
+
+	for (i = 0; realcall[i]; i++) {
+		a = adindex(realcall[i]);
+		wrong = (i >= inlen || input[i] != realcall[i]);
+		adseen[a]++;
+		aderr[a] += wrong;
+		if (i) {
+			b = adindex(realcall[i-1]);
+			adseen2[b][a]++;
+			aderr2[b][a] += (wrong || prevwrong);
+		}
+		prevwrong = wrong;
+	}
+	addirty = 1;
+}
+
+static int adindex (char c) {
+	if (c >= 'A' && c <= 'Z') {
+		return c - 'A';
+	}
+	else if (c >= '0' && c <= '9') {
+		return 26 + c - '0';
+	}
+	return (c == '/') ? 36 : 37;
+}
+
+/* adaptive_pick draws an unused call with a probability proportional to
+ * its predicted difficulty. Returns -1 if that doesn't work out quickly
+ * (few unused calls left), then a uniform pick is made. */
+
+static int adaptive_pick () {
+	int k;
+	uint32_t i;
+
+	if (adgen != cbgen || adn != nrofcalls) {	/* new callbase */
+		adphase = 0;
+		addirty = 1;
+		adaptive_step(0);
+	}
+	adaptive_step(ADCHUNK);
+
+	for (k = 0; k < 32; k++) {
+		i = rng_below(&rng_main, adn);
+		if (rng_double(&rng_main) >= adprob[i]) {
+			i = adalias[i];
+		}
+		if (cbinv[i] >= cbpos && cbinv[i] < cbactive) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* adaptive_step does up to 'work' steps of rebuilding the alias table, or
+ * the whole rebuild if work is 0. Vose's method, in three phases: weights,
+ * scaling and splitting into the small/large work lists, pairing. */
+
+static void adaptive_step (uint32_t work) {
+	uint32_t i, s, l, n = nrofcalls, end, budget = work;
+	float *tf;
+	uint32_t *tu;
+	const char *c;
+	double w;
+	int a, b;
+
+	if (adgen != cbgen || adn != n) {		/* (re)allocate */
+		free(adprobmem);
+		adprob = adprobmem = malloc(3 * n * sizeof(float));
+		free(adaliasmem);
+		adalias = adaliasmem = malloc(3 * n * sizeof(uint32_t));
+		if (adprob == NULL || adalias == NULL) {
+			fprintf(stderr, "Error: Couldn't allocate %d bytes!\n", 
+						(int) (3 * n * (sizeof(float) + sizeof(uint32_t))));
+			exit(EXIT_FAILURE);
+		}
+		adnprob = adprob + n;
+		adw = adprob + 2*n;
+		adnalias = adalias + n;
+		adwork = adalias + 2*n;
+		adn = n;
+		adgen = cbgen;
+	}
+
+	if (adphase == 0) {
+		if (!addirty) {
+			return;
+		}
+		/* error rates with a prior of 1 in 10, so unknown characters
+		 * count as difficult as ones with 10% errors */
+		for (a = 0; a < ADCHARS; a++) {
+			adrate[a] = (aderr[a] + 1.0)/(adseen[a] + 10.0);
+			for (b = 0; b < ADCHARS; b++) {
+				adrate2[a][b] = (aderr2[a][b] + 1.0)/(adseen2[a][b] + 10.0);
+			}
+		}
+		addirty = 0;
+		adphase = 1;
+		adi = 0;
+		adsum = 0;
+	}
+
+	while (adphase) {
+		if (work == 0) {			/* all at once */
+			end = n;
+		}
+		else if (budget == 0) {
+			break;
+		}
+		else {
+			end = (n - adi > budget) ? adi + budget : n;
+			budget -= end - adi;
+		}
+
+		switch (adphase) {
+			case 1:		/* weights: sum of the error rates */
+				for (i = adi; i < end; i++) {
+					if (cbinv[i] >= cbactive) {		/* filtered out */
+						adw[i] = 0;
+						continue;
+					}
+					w = 0.05;
+					b = -1;
+					for (c = cb_call(i); *c; c++) {
+						a = adindex(*c);
+						w += adrate[a];
+						if (b >= 0) {
+							w += adrate2[b][a];
+						}
+						b = a;
+					}
+					adw[i] = (float) w;
+					adsum += w;
+				}
+				break;
+			case 2:		/* scale to mean 1, small ones from the start of
+						   adwork, large ones from the end */
+				if (adi == 0) {
+					adsmall = 0;
+					adlarge = n;
+				}
+				for (i = adi; i < end; i++) {
+					adnprob[i] = (float) (adw[i] * n / adsum);
+					if (adnprob[i] < 1.0f) {
+						adwork[adsmall++] = i;
+					}
+					else {
+						adwork[--adlarge] = i;
+					}
+				}
+				break;
+			case 3:		/* pair every small one with a large one */
+				for (i = adi; i < end && adsmall && adlarge < n; i++) {
+					s = adwork[--adsmall];
+					l = adwork[adlarge];
+					adnalias[s] = l;
+					adnprob[l] -= 1.0f - adnprob[s];
+					if (adnprob[l] < 1.0f) {
+						adlarge++;
+						adwork[adsmall++] = l;
+					}
+				}
+				if (!(adsmall && adlarge < n) || end == n) {	/* done */
+					while (adsmall) {
+						adnprob[adwork[--adsmall]] = 1.0f;
+					}
+					while (adlarge < n) {
+						adnprob[adwork[adlarge++]] = 1.0f;
+					}
+					end = n;
+				}
+				break;
+		}
+
+		adi = end;
+		if (adi == n) {
+			adi = 0;
+			if (++adphase == 4) {		/* new table complete, swap */
+				tf = adprob; adprob = adnprob; adnprob = tf;
+				tu = adalias; adalias = adnalias; adnalias = tu;
+				adphase = 0;
+			}
+		}
+	}
+}
+
+/* replay_start opens the replay file (lastattempt.rpl, next to the toplist)
+ * and writes the seed and all settings that influence the attempt */
+
+static void replay_start (uint64_t aseed) {
+	char filename[PATH_MAX];
+
+	if (replayfh) {
+		fclose(replayfh);
+	}
+	strcpy(filename, tlfilename);
+	strcpy(filename, dirname(filename));
+	strcat(filename, "/lastattempt.rpl");
+	if ((replayfh = fopen(filename, "w")) == NULL) {
+		return;				/* no replay file, not worth to stop */
+	}
+	replaybase = score;
+
+	fprintf(replayfh, "qrq-replay 2\nseed %llu\ncallbase %s\nmycall %s\n"
+					"valid %d\nsamplerate %ld\nwaveform %d\nedge %f\n"
+					"mincharspeed %d\nchannel %d %d %d %d %d\ncalls\n",
+					(unsigned long long) aseed, cbfilename, mycall, 
+					attemptvalid, samplerate, waveform, edge, mincharspeed,
+					noise, snr, qsb, qrm, qrn);
+}
+
+/* replay_call adds one call of the attempt: the call, pitch, speed and
+ * the input ("-" if empty, "*" if a pileup call was not copied). The call
+ * itself is saved, as a streamed callbase may draw a new sample before. */
+
+static void replay_call (char *call, int f, int s, char *input) {
+	if (replayfh) {
+		fprintf(replayfh, "%s %d %d %s\n", call, f, s, 
+					input == NULL ? "*" : (input[0] ? input : "-"));
+	}
+}
+
+static void replay_end () {
+	if (replayfh) {
+		fprintf(replayfh, "score %d\n", score - replaybase);
+		fclose(replayfh);
+		replayfh = NULL;
+	}
+}
+
+/* replay_mode renders and scores all calls of a replay file, without
+ * audio output, and reports the score and the time it took. Every run of
+ * the same file does exactly the same work, so it can be used to compare
+ * machines and builds. */
+
+static int replay_mode (char *filename) {
+	FILE *fh;
+	char line[PATH_MAX + 20], tmp[80], call[80], input[80];
+	unsigned long long aseed = 0;
+	int f, s, nr = 0, recorded = -1, version = 0;
+	clock_t start;
+
+	if ((fh = fopen(filename, "r")) == NULL) {
+		fprintf(stderr, "Error: Couldn't read replay file '%s'!\n", filename);
+		return EXIT_FAILURE;
+	}
+
+	/* header */
+	while (fgets(line, sizeof(line), fh) != NULL && strcmp(line, "calls\n")) {
+		sscanf(line, "qrq-replay %d", &version);
+		sscanf(line, "seed %llu", &aseed);
+		if (!strncmp(line, "callbase ", 9)) {
+			line[strcspn(line, "\n")] = '\0';
+			if (strlen(line + 9) < PATH_MAX) {
+				strcpy(cbfilename, line + 9);
+			}
+		}
+		sscanf(line, "valid %d", &attemptvalid);
+		sscanf(line, "samplerate %ld", &samplerate);
+		sscanf(line, "waveform %d", &waveform);
+		sscanf(line, "edge %lf", &edge);
+		sscanf(line, "mincharspeed %d", &mincharspeed);
+		sscanf(line, "channel %d %d %d %d %d", &noise, &snr, &qsb, &qrm, &qrn);
+	}
+	if (version != 2) {
+		fprintf(stderr, "Error: '%s' is not a qrq replay file!\n", filename);
+		fclose(fh);
+		return EXIT_FAILURE;
+	}
+
+	rng_seed(aseed);
+	score = 0;
+	start = clock();
 
-			while ((feof(fh2) == 0) && (fgets(line, 35, fh2) != NULL)) {
-					line[20]=' ';
-					strcpy(tmp, line);
-					strcat(tmp, "1181234567\n");
-					fputs(tmp, fh);
+	while (fgets(line, sizeof(line), fh) != NULL) {
+		if (sscanf(line, "score %d", &recorded) == 1) {
+			break;
+		}
+		if (sscanf(line, "%79s %d %d %79s", call, &f, &s, input) != 4) {
+			fprintf(stderr, "Error: '%s' is damaged!\n", filename);
+			fclose(fh);
+			return EXIT_FAILURE;
+		}
+		full_bufpos = 0;
+		sig_len = 0;
+		render_cw(call, f, s);
+		nr++;
+
+		if (!strcmp(input, "*")) {		/* pileup call not copied */
+			errornr++;
+			continue;
+		}
+		if (!strcmp(input, "-")) {
+			input[0] = '\0';
+		}
+		speed = s;
+		score += calc_score(call, input, s, tmp);
+	}
+	fclose(fh);
+
+	printf("%d calls, score %d (recorded: %d), %.3f s\n", nr, score, 
+				recorded, (double) (clock() - start) / CLOCKS_PER_SEC);
+	return (score == recorded) ? 0 : EXIT_FAILURE;
+}
+
+/* log_start opens the session log (sessions.qsl, next to the toplist)
+ * and starts a new attempt in it. Every record is appended with a single
+ * write, so several qrq instances can share the log; a record that was
+ * cut off by a crash is skipped by qrq --query. */
+
+static void log_start () {
+	char filename[PATH_MAX];
+	unsigned char rec[80];
+	int len;
+
+	if (logfd >= 0) {
+		close(logfd);
+	}
+	strcpy(filename, tlfilename);
+	strcpy(filename, dirname(filename));
+	strcat(filename, "/sessions.qsl");
+	if ((logfd = open(filename, O_WRONLY | O_APPEND | O_CREAT | O_BINARY,
+							0644)) < 0) {
+		return;				/* no session log, not worth to stop */
+	}
+	if (lseek(logfd, 0, SEEK_END) == 0 && write(logfd, LOG_MAGIC, 4) != 4) {
+		close(logfd);
+		logfd = -1;
+		return;
+	}
+
+	/* different for every attempt of every instance */
+	logid = (uint32_t) time(NULL) * 2654435761U ^ (uint32_t) now_ms() ^ 
+					((uint32_t) getpid() << 16);
+	rec[2] = 'A';
+	len = 3;
+	len += put_varint(rec + len, logid);
+	len += put_varint(rec + len, (uint32_t) time(NULL));
+	len += put_string(rec + len, mycall);
+	len += put_varint(rec + len, (attemptvalid ? LOG_VALID : 0) |
+					(unlimitedattempt ? LOG_UNLIMITED : 0) |
+					(continuous ? LOG_CONTINUOUS : 0));
+	len += put_varint(rec + len, pileup);
+	log_write(rec, len);
+}
+
+/* log_call adds one call: its nr. in the attempt, what was sent and
+ * entered, pitch, speed, points, the LOG_* flags and the time since
+ * 'logstart' */
+
+static void log_call (int nr, char *call, char *input, int f, int s, 
+				int points, int flags) {
+	unsigned char rec[160];
+	int len;
+
+	if (logfd < 0) {
+		return;
+	}
+	rec[2] = 'C';
+	len = 3;
+	len += put_varint(rec + len, logid);
+	len += put_varint(rec + len, nr);
+	len += put_string(rec + len, call);
+	len += put_string(rec + len, input);
+	len += put_varint(rec + len, f);
+	len += put_varint(rec + len, s);
+	len += put_varint(rec + len, points);
+	len += put_varint(rec + len, flags);
+	len += put_varint(rec + len, (uint32_t) (now_ms() - logstart));
+	log_write(rec, len);
+}
+
+static void log_end () {
+	unsigned char rec[32];
+	int len;
+
+	if (logfd < 0) {
+		return;
+	}
+	rec[2] = 'E';
+	len = 3;
+	len += put_varint(rec + len, logid);
+	len += put_varint(rec + len, score);
+	len += put_varint(rec + len, maxspeed);
+	log_write(rec, len);
+	close(logfd);
+	logfd = -1;
+}
+
+/* log_write completes the record 'rec' of 'len' bytes (the type at rec[2])
+ * with the sync byte, length and checksum, and appends it */
+
+static void log_write (unsigned char *rec, int len) {
+	int i, sum = 0;
+
+	for (i = 2; i < len; i++) {
+		sum = (sum * 31 + rec[i]) & 0xff;
+	}
+	rec[0] = LOG_SYNC;
+	rec[1] = len - 1;					/* the rest, with the checksum */
+	rec[len++] = sum;
+	if (write(logfd, rec, len) != len) {
+		close(logfd);					/* disk full? stop logging */
+		logfd = -1;
+	}
+}
+
+/* put_varint writes 'v' in 7 bit groups, lowest first, with the high bit
+ * set in all but the last byte. Returns the number of bytes (1..5). */
+
+static int put_varint (unsigned char *p, uint32_t v) {
+	int n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/* put_string writes the length of 'str' (max. 40) and its characters */
+
+static int put_string (unsigned char *p, const char *str) {
+	int n = strlen(str) > 40 ? 40 : strlen(str);
+
+	p[0] = n;
+	memcpy(p + 1, str, n);
+	return n + 1;
+}
+
+/* get_varint and get_string read fields written by put_varint and
+ * put_string from a record, '*p' up to 'end'. They return -1 if the record
+ * ends before. */
+
+static int get_varint (unsigned char **p, unsigned char *end, uint32_t *v) {
+	int shift;
+
+	*v = 0;
+	for (shift = 0; shift < 35 && *p < end; shift += 7) {
+		*v |= (uint32_t) (**p & 0x7f) << shift;
+		if (!(*(*p)++ & 0x80)) {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int get_string (unsigned char **p, unsigned char *end, char *str,
+				int size) {
+	int n;
+
+	if (*p >= end || (n = *(*p)++) >= size || n > end - *p) {
+		return -1;
+	}
+	memcpy(str, *p, n);
+	str[n] = '\0';
+	*p += n;
+	return 0;
+}
+
+/* log_read reads the next record of a session log into 'rec' (at least
+ * 256 bytes) and returns its length without the checksum, or -1 at the
+ * end. Anything that isn't a complete record is skipped, the number of
+ * bytes is added to 'skipped'. */
+
+static int log_read (FILE *fh, unsigned char *rec, int *skipped) {
+	long pos;
+	int c, len, i, sum;
+
+	while ((c = getc(fh)) != EOF) {
+		if (c != LOG_SYNC) {
+			(*skipped)++;
+			continue;
+		}
+		pos = ftell(fh);
+		if ((len = getc(fh)) != EOF && len >= 2 && 
+						(int) fread(rec, 1, len, fh) == len) {
+			for (sum = i = 0; i < len - 1; i++) {
+				sum = (sum * 31 + rec[i]) & 0xff;
 			}
-			
-			printw(" done!\n");
-	
-			fclose(fh2);
+			if (sum == rec[len-1]) {
+				return len - 1;
+			}
+		}
+		/* cut off, or a LOG_SYNC in the middle of one: go on behind it */
+		fseek(fh, pos, SEEK_SET);
+		(*skipped)++;
+	}
+	return -1;
+}
+
+/* now_ms: a clock in milliseconds, for the response times */
+
+static unsigned long now_ms () {
+#ifndef WIN32
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+#else
+	return GetTickCount();
+#endif
+}
+
+/* query_log reads the session logs 'files' (or sessions.qsl next to the
+ * toplist) in one pass and prints
+ * chars: the error rate of every character,
+ * speed: attempts, errors and speed for every month,
+ * slow:  the calls that took the longest to enter after they were sent.
+ * The memory use doesn't depend on the size of the logs. */
+
+static int query_log (char *what, int nr, char **files) {
+	FILE *fh;
+	char filename[PATH_MAX], magic[4], call[48], input[48], date[16];
+	int chsent[128], cherr[128], order[128];
+	struct {
+		int attempts, calls, errors, maxspeed;
+		double speed;
+	} *months = NULL;
+	struct {
+		char call[48], input[48];
+		int speed, ms, reaction, time;
+	} slow[LOG_SLOWEST];
+	struct {							/* the attempts running */
+		uint32_t id;
+		int when, month, pu;
+	} att[LOG_ATTEMPTS], *a;
+	unsigned char rec[256], *p, *end;
+	int nrmonths = 0, nrslow = 0, nratt = 0, mode;
+	int i, j, k, c, len, err = 0, skipped = 0;
+	uint32_t v[8];
+	struct tm *tm;
+	time_t t;
+	char *defname[1];
+
+	if (!strcmp(what, "chars")) {
+		mode = 0;
+	}
+	else if (!strcmp(what, "speed")) {
+		mode = 1;
+	}
+	else if (!strcmp(what, "slow")) {
+		mode = 2;
+	}
+	else {
+		help();
+	}
+	if (nr == 0) {
+		strcpy(filename, tlfilename);
+		strcpy(filename, dirname(filename));
+		strcat(filename, "/sessions.qsl");
+		defname[0] = filename;
+		files = defname;
+		nr = 1;
+	}
+	memset(chsent, 0, sizeof(chsent));
+	memset(cherr, 0, sizeof(cherr));
+
+	for (i = 0; i < nr && !err; i++) {
+		if ((fh = fopen(files[i], "rb")) == NULL) {
+			fprintf(stderr, "Error: Couldn't read '%s'!\n", files[i]);
+			err = 1;
+			break;
+		}
+		if (fread(magic, 1, 4, fh) != 4 || memcmp(magic, LOG_MAGIC, 4)) {
+			fprintf(stderr, "Error: '%s' is not a qrq session log!\n", 
+							files[i]);
+			fclose(fh);
+			err = 1;
+			break;
+		}
+		while ((len = log_read(fh, rec, &skipped)) >= 0) {
+			p = rec + 1;
+			end = rec + len;
+			if (get_varint(&p, end, &v[7])) {
+				continue;
+			}
+			for (a = NULL, k = 0; k < nratt; k++) {
+				if (att[k].id == v[7]) {
+					a = &att[k];
+				}
+			}
+			if (rec[0] == 'A') {
+				if (get_varint(&p, end, &v[0]) || get_string(&p, end, call,
+						sizeof(call)) || get_varint(&p, end, &v[1]) || 
+						get_varint(&p, end, &v[2])) {
+					continue;
+				}
+				if (!a) {
+					if (nratt == LOG_ATTEMPTS) {	/* the oldest one goes */
+						memmove(att, att + 1, --nratt * sizeof(att[0]));
+					}
+					a = &att[nratt++];
+				}
+				a->id = v[7];
+				a->when = v[0];
+				a->pu = v[2] > 1;
+				t = a->when;
+				tm = localtime(&t);
+				a->month = (tm->tm_year - 70) * 12 + tm->tm_mon;
+				if (mode == 1 && a->month >= nrmonths) {
+					if ((months = realloc(months, (a->month + 1) * 
+									sizeof(*months))) == NULL) {
+						fprintf(stderr, "Error: Couldn't allocate "
+									"memory!\n");
+						exit(EXIT_FAILURE);
+					}
+					memset(months + nrmonths, 0, (a->month + 1 - nrmonths) *
+									sizeof(*months));
+					nrmonths = a->month + 1;
+				}
+				if (mode == 1) {
+					months[a->month].attempts++;
+				}
+			}
+			else if (rec[0] == 'C') {
+				if (get_varint(&p, end, &v[0]) || get_string(&p, end, call, 
+						sizeof(call)) || get_string(&p, end, input, 
+						sizeof(input))) {
+					continue;
+				}
+				for (k = 1; k < 6 && !get_varint(&p, end, &v[k]); k++)
+					;
+				if (k < 6) {
+					continue;
+				}
+				/* v: 1 pitch, 2 speed, 3 points, 4 flags, 5 ms */
+				if (mode == 0) {
+					for (j = 0, k = strlen(input); call[j]; j++) {
+						chsent[call[j] & 0x7f]++;
+						if (j >= k || input[j] != call[j]) {
+							cherr[call[j] & 0x7f]++;
+						}
+					}
+				}
+				else if (!a) {			/* start of the attempt is lost */
+					continue;
+				}
+				else if (mode == 1) {
+					months[a->month].calls++;
+					months[a->month].errors += strcmp(call, input) != 0;
+					months[a->month].speed += v[2];
+					if ((int) v[2] > months[a->month].maxspeed) {
+						months[a->month].maxspeed = v[2];
+					}
+				}
+				else if (mode == 2 && !a->pu && v[2]) {
+					/* time after the call was sent (roughly) */
+					k = (int) v[5] - morse_units(call) * 6000 / (int) v[2];
+					if (k < 0) {
+						k = 0;
+					}
+					if (nrslow < LOG_SLOWEST) {
+						nrslow++;
+					}
+					else if (k <= slow[nrslow-1].reaction) {
+						continue;
+					}
+					for (j = nrslow - 1; j > 0 && slow[j-1].reaction < k; 
+									j--) {
+						slow[j] = slow[j-1];
+					}
+					strcpy(slow[j].call, call);
+					strcpy(slow[j].input, input[0] ? input : "-");
+					slow[j].speed = v[2];
+					slow[j].ms = v[5];
+					slow[j].reaction = k;
+					slow[j].time = a->when;
+				}
+			}
+			else if (rec[0] == 'E' && a) {	/* attempt finished */
+				nratt--;
+				memmove(a, a + 1, (att + nratt - a) * sizeof(att[0]));
+			}
+		}
+		fclose(fh);
+	}
+	if (skipped) {
+		fprintf(stderr, "Warning: %d damaged byte(s) skipped.\n", skipped);
+	}
+
+	if (!err && mode == 0) {
+		/* characters with the highest error rate first */
+		for (k = 0, c = 0; c < 128; c++) {
+			if (!chsent[c]) {
+				continue;
+			}
+			for (j = k++; j > 0 && (double) cherr[order[j-1]] * chsent[c] <
+							(double) cherr[c] * chsent[order[j-1]]; j--) {
+				order[j] = order[j-1];
+			}
+			order[j] = c;
+		}
+		printf("Char     Sent   Errors   Rate\n");
+		for (j = 0; j < k; j++) {
+			c = order[j];
+			printf("%c    %8d %8d %5.1f%%\n", c, chsent[c], cherr[c], 
+							100.0 * cherr[c] / chsent[c]);
+		}
+	}
+	else if (!err && mode == 1) {
+		printf("Month    Attempts    Calls   Errors  Speed   Max.\n");
+		for (j = 0; j < nrmonths; j++) {
+			if (!months[j].attempts && !months[j].calls) {
+				continue;
+			}
+			printf("%04d-%02d  %8d %8d %7.1f%% %6.0f %6d\n", 1970 + j / 12,
+				j % 12 + 1, months[j].attempts, months[j].calls, 
+				months[j].calls ? 100.0 * months[j].errors / months[j].calls : 0,
+				months[j].calls ? months[j].speed / months[j].calls : 0, 
+				months[j].maxspeed);
+		}
+	}
+	else if (!err) {
+		printf("Date        Call        Input       Speed   Time  Reaction\n");
+		for (j = 0; j < nrslow; j++) {
+			t = slow[j].time;
+			strftime(date, sizeof(date), "%Y-%m-%d", localtime(&t));
+			printf("%s  %-11s %-11s %5d %6.1fs %8.1fs\n", date, 
+					slow[j].call, slow[j].input, slow[j].speed, 
+					slow[j].ms / 1000.0, slow[j].reaction / 1000.0);
+		}
+	}
+	free(months);
+	return err ? EXIT_FAILURE : 0;
+}
+
+/* save_checkpoint writes the checkpoint of the running unlimited attempt,
+ * which continues with call nr. 'nr'. The 'nskip' calls in 'skip' count as
+ * unused: they were picked, but not copied yet. Returns 1 if the
+ * checkpoint was written. */
+
+static int save_checkpoint (int nr, const int *skip, int nskip) {
+	FILE *fh;
+	struct stat st;
+	char tmpname[PATH_MAX+16], dir[PATH_MAX], *name;
+	unsigned char *bits;
+	uint32_t j, size = (nrofcalls + 7) / 8;
+	int ok = 0;
+
+	if (cbgenerated || cbline || (name = home_file("checkpoint")) == NULL) {
+		return 0;
+	}
+	if ((bits = calloc(size ? size : 1, 1)) == NULL) {
+		return 0;
+	}
+	for (j = 0; j < cbpos; j++) {
+		bits[cbperm[j] / 8] |= 1 << (cbperm[j] % 8);
+	}
+	for (j = 0; j < nskip; j++) {
+		bits[skip[j] / 8] &= ~(1 << (skip[j] % 8));
+	}
+
+	strcpy(dir, name);
+#ifdef WIN32
+	mkdir(dirname(dir));
+#else
+	mkdir(dirname(dir), 0777);
+#endif
+	if (stat(cbfilename, &st)) {
+		st.st_size = st.st_mtime = 0;
+	}
+	if ((fh = open_replace(name, tmpname)) != NULL) {
+		fprintf(fh, "qrq-checkpoint 1\ncallbase %s\nfilter %s\nmycall %s\n"
+						"file %ld %ld\ncalls %lu\nstate %d %d %d %d %d\nbits\n",
+						cbfilename, cbfilter, mycall, (long) st.st_size, 
+						(long) st.st_mtime, (unsigned long) nrofcalls, nr, 
+						score, maxspeed, speed, errornr);
+		if (fwrite(bits, 1, size, fh) != size) {
+			fclose(fh);
+			remove(tmpname);
+		}
+		else {
+			ok = !commit_replace(fh, tmpname, name);
+		}
+	}
+	free(bits);
+	return ok;
+}
+
+/* read_checkpoint reads the header of the checkpoint into 'c' and returns
+ * the file, at the start of the bitset, or NULL */
+
+static FILE *read_checkpoint (struct checkpoint *c) {
+	FILE *fh;
+	char line[PATH_MAX+16], *name;
+	int version = 0, ok = 0;
 
+	if ((name = home_file("checkpoint")) == NULL || 
+					(fh = fopen(name, "rb")) == NULL) {
+		return NULL;
+	}
+	memset(c, 0, sizeof(struct checkpoint));
+	while (fgets(line, sizeof(line), fh) != NULL) {
+		if (!strcmp(line, "bits\n")) {
+			ok = 1;
+			break;
+		}
+		line[strcspn(line, "\n")] = '\0';
+		sscanf(line, "qrq-checkpoint %d", &version);
+		if (!strncmp(line, "callbase ", 9) && strlen(line + 9) < PATH_MAX) {
+			strcpy(c->callbase, line + 9);
+		}
+		if (!strncmp(line, "filter ", 7) && strlen(line + 7) <= FILTERLEN) {
+			strcpy(c->filter, line + 7);
+		}
+		if (!strncmp(line, "mycall ", 7) && strlen(line + 7) < 15) {
+			strcpy(c->mycall, line + 7);
+		}
+		sscanf(line, "file %ld %ld", &c->size, &c->mtime);
+		sscanf(line, "calls %lu", &c->calls);
+		sscanf(line, "state %d %d %d %d %d", &c->callnr, &c->score, 
+						&c->maxspeed, &c->speed, &c->errors);
+	}
+	if (!ok || version != 1 || c->callnr < 1) {
+		fclose(fh);
+		return NULL;
+	}
+	return fh;
+}
+
+/* checkpoint_info returns 1 if there is a checkpoint that can be continued
+ * now (same callbase, unlimited attempts), its header in 'c' */
+
+static int checkpoint_info (struct checkpoint *c) {
+	FILE *fh;
+
+	if (!unlimitedattempt || !strcmp(cbfilename, GENCALLBASE) || 
+					(fh = read_checkpoint(c)) == NULL) {
+		return 0;
+	}
+	fclose(fh);
+	return !strcmp(c->callbase, cbfilename);
+}
+
+/* restore_checkpoint marks the calls of the checkpoint as used (after
+ * reset_calls) and takes over the state of the attempt. Returns the nr.
+ * of the next call, or 0 if the checkpoint doesn't fit the callbase. */
+
+static int restore_checkpoint () {
+	FILE *fh;
+	struct checkpoint c;
+	struct stat st;
+	uint32_t i, j;
+	int b, k;
+
+	if ((fh = read_checkpoint(&c)) == NULL) {
+		return 0;
+	}
+	if (stat(cbfilename, &st)) {
+		st.st_size = st.st_mtime = 0;
+	}
+	if (cbline || strcmp(c.callbase, cbfilename) || strcmp(c.filter, 
+				cbfilter) || c.calls != nrofcalls || c.size != st.st_size || 
+				c.mtime != (long) st.st_mtime) {
+		fclose(fh);
+		return 0;
 	}
 
+	for (i = 0; i < nrofcalls && (b = getc(fh)) != EOF; i += 8) {
+		for (k = 0; k < 8 && b; k++, b >>= 1) {
+			if ((b & 1) && i + k < nrofcalls && 
+						(j = cbinv[i + k]) != UINT32_MAX && j >= cbpos) {
+				use_call(j);
+			}
+		}
+	}
 	fclose(fh);
 
-	return 0;
+	strcpy(mycall, c.mycall);
+	score = c.score;
+	maxspeed = c.maxspeed;
+	speed = c.speed;
+	errornr = c.errors;
+	return c.callnr;
+}
+
+/* remove_checkpoint deletes the checkpoint when its attempt is over */
+
+static void remove_checkpoint () {
+	struct checkpoint c;
+
+	if (checkpoint_info(&c)) {
+		remove(home_file("checkpoint"));
+	}
+}
+
+/* prefixes and weights for the generated callbase, roughly their share of
+ * the calls in big contest logs (in 1/1000) */
+
+static const struct {
+	const char *prefix;
+	int weight;
+} genprefixes[] = {
+	{"K", 70}, {"W", 70}, {"N", 40}, {"AA", 3}, {"AB", 2}, {"AC", 2},
+	{"AD", 2}, {"AE", 2}, {"AF", 2}, {"AG", 2}, {"AI", 2}, {"AJ", 1},
+	{"AK", 1}, {"KA", 3}, {"KB", 3}, {"KC", 3}, {"KD", 3}, {"KE", 3},
+	{"KF", 2}, {"KG", 2}, {"KI", 2}, {"KJ", 1}, {"KK", 1}, {"KN", 1},
+	{"KO", 1}, {"NA", 1}, {"WA", 3}, {"WB", 3}, {"WD", 2}, {"VE", 15},
+	{"VA", 8}, {"DL", 45}, {"DK", 12}, {"DJ", 8}, {"DO", 6}, {"DF", 5},
+	{"DG", 5}, {"DH", 4}, {"DM", 4}, {"G", 25}, {"M", 15}, {"2E", 3},
+	{"GM", 4}, {"GW", 3}, {"GI", 2}, {"EI", 3}, {"F", 20}, {"ON", 10},
+	{"PA", 15}, {"PD", 4}, {"I", 25}, {"IK", 8}, {"IZ", 10}, {"IW", 4},
+	{"EA", 25}, {"EB", 2}, {"EC", 2}, {"CT", 6}, {"OK", 15}, {"OL", 2},
+	{"OM", 8}, {"SP", 25}, {"SQ", 8}, {"SO", 3}, {"HA", 10}, {"HG", 3},
+	{"YO", 10}, {"LZ", 8}, {"S5", 6}, {"9A", 8}, {"E7", 4}, {"YU", 5},
+	{"Z3", 2}, {"SV", 6}, {"OE", 8}, {"HB", 8}, {"LY", 6}, {"YL", 4},
+	{"ES", 4}, {"OH", 12}, {"SM", 12}, {"SA", 3}, {"LA", 6}, {"OZ", 8},
+	{"TF", 1}, {"UA", 25}, {"RA", 10}, {"RU", 4}, {"RW", 4}, {"RZ", 4},
+	{"R", 6}, {"UR", 10}, {"UT", 6}, {"US", 4}, {"UX", 4}, {"EW", 4},
+	{"4X", 3}, {"4Z", 1}, {"JA", 30}, {"JH", 8}, {"JR", 6}, {"JE", 4},
+	{"JF", 4}, {"JG", 4}, {"JI", 3}, {"JJ", 3}, {"JK", 3}, {"JL", 2},
+	{"JO", 3}, {"BY", 4}, {"BG", 3}, {"BD", 2}, {"HL", 6}, {"DS", 3},
+	{"BV", 3}, {"VU", 4}, {"HS", 2}, {"9M", 2}, {"YB", 5}, {"DU", 3},
+	{"VK", 10}, {"ZL", 5}, {"PY", 10}, {"PP", 2}, {"PU", 3}, {"LU", 6},
+	{"CE", 3}, {"CX", 2}, {"HK", 2}, {"YV", 2}, {"XE", 4}, {"CO", 2},
+	{"ZS", 3}, {"CN", 2}, {"SU", 1}, {"5H", 1}
+};
+#define GENPREFIXES (sizeof(genprefixes)/sizeof(genprefixes[0]))
+
+/* gen_call makes call nr. 'i' of the generated callbase. Returns 0 if
+ * there's no such call: only weight/GENWMAX of the calls of a prefix are
+ * used, about 2.5 million calls in all. */
+
+static int gen_call (uint32_t i, char *call) {
+	uint64_t x = i, h;
+	int k, len, digit;
+
+	h = splitmix64(&x);
+	digit = i % 10;
+	i /= 10;
+	k = i % GENSUFFIXES;
+	i /= GENSUFFIXES;
+	if (i >= GENPREFIXES || h % GENWMAX >= genprefixes[i].weight) {
+		return 0;
+	}
+
+	strcpy(call, genprefixes[i].prefix);
+	len = strlen(call);
+	call[len++] = '0' + digit;
+
+	/* suffix: k is its number in order of length */
+	if (k < 26) {
+		call[len++] = 'A' + k;
+	}
+	else if ((k -= 26) < 26*26) {
+		call[len++] = 'A' + k / 26;
+		call[len++] = 'A' + k % 26;
+	}
+	else {
+		k -= 26*26;
+		call[len++] = 'A' + k / (26*26);
+		call[len++] = 'A' + k / 26 % 26;
+		call[len++] = 'A' + k % 26;
+	}
+	call[len] = '\0';
+
+	k = (h >> 40) % 1000;
+	if (k < 30) {
+		strcat(call, "/P");
+	}
+	else if (k < 40) {
+		strcat(call, "/M");
+	}
+	else if (k < 42) {
+		strcat(call, "/MM");
+	}
+	return 1;
+}
+
+/* gen_pick picks the next generated call that matches the filter.
+ * Returns its number. */
+
+static int gen_pick (char *call) {
+	char globs[FILTERLEN+1], *g[FILTERLEN/2+1];
+	int ng, minlen, maxlen, tries;
+	uint32_t i;
+
+	strcpy(globs, cbfilter);
+	parse_filter(globs, g, &ng, &minlen, &maxlen);
+
+	for (tries = 0; ; tries++) {
+		if (genpos >= GENCALLS) {		/* all sent, start over */
+			gen_key();
+		}
+		i = gen_perm(genpos++);
+		if (!gen_call(i, call)) {
+			continue;
+		}
+		if (tries < GENTRIES && !match_filter(call, g, ng, minlen, maxlen)) {
+			continue;
+		}
+		return i;
+	}
+}
+
+/* gen_perm maps 'i' to its place in a random order of 0..GENCALLS-1: four
+ * rounds of a Feistel network, keyed by genkey */
+
+static uint32_t gen_perm (uint32_t i) {
+	uint32_t l = i >> GENHALF, r = i & GENMASK, t;
+	uint64_t z;
+	int k;
+
+	for (k = 0; k < 4; k++) {
+		z = genkey[k] ^ r;
+		t = r;
+		r = l ^ (splitmix64(&z) & GENMASK);
+		l = t;
+	}
+	return (l << GENHALF) | r;
 }
 
+/* gen_key starts a new order of the generated calls */
 
+static void gen_key () {
+	int k;
 
-/* See where our files are. We need 'callbase.qcb', 'qrqrc' and 'toplist'.
- * The can be: 
- * 1) In the current directory -> use them
- * 2) In ~/.qrq/  -> use toplist and qrqrc from there and callbase from
- *    DESTDIR/share/qrq/
- * 3) in DESTDIR/share/qrq/ -> create ~/.qrq/ and copy qrqrc and toplist
- *    there.
- * 4) Nowhere --> Exit.*/
-static int find_files () {
-	
-	FILE *fh;
-	const char *homedir = NULL;
-	char tmp_rcfilename[1024] = "";
-	char tmp_tlfilename[1024] = "";
-	char tmp_cbfilename[1024] = "";
+	for (k = 0; k < 4; k++) {
+		genkey[k] = rng_next(&rng_main);
+	}
+	genpos = 0;
+}
 
-	printw("\nChecking for necessary files (qrqrc, toplist, callbase)...\n");
-	
-	if (((fh = fopen("qrqrc", "r")) == NULL) ||
-		((fh = fopen("toplist", "r")) == NULL) ||
-		((fh = fopen("callbase.qcb", "r")) == NULL)) {
-		
-		if ((homedir = getenv("HOME")) != NULL) {
-		printw("... not found in current directory. Checking "
-						"%s/.qrq/...\n", homedir);
-		refresh();
-		strcat(rcfilename, homedir);
-		}
-		else {
-		printw("... not found in current directory. Checking "
-						"./.qrq/...\n", homedir);
-		refresh();
-		strcat(rcfilename, ".");
-		}
-				
-		strcat(rcfilename, "/.qrq/qrqrc");
-	
-		/* check if there is ~/.qrq/qrqrc. If it's there, it's safe to assume
-		 * that toplist also exists at the same place and callbase exists in
-		 * DESTDIR/share/qrq/. */
+/* splitmix64 by S. Vigna: a fast generator for seeding */
 
-		if ((fh = fopen(rcfilename, "r")) == NULL ) {
-			printw("... not found in %s/.qrq/. Checking %s/share/qrq..."
-							"\n", homedir, destdir);
-			/* check for the files in DESTDIR/share/qrq/. if exists, copy 
-			 * qrqrc and toplist to ~/.qrq/  */
+static uint64_t splitmix64 (uint64_t *x) {
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
 
-			strcpy(tmp_rcfilename, destdir);
-			strcat(tmp_rcfilename, "/share/qrq/qrqrc");
-			strcpy(tmp_tlfilename, destdir);
-			strcat(tmp_tlfilename, "/share/qrq/toplist");
-			strcpy(tmp_cbfilename, destdir);
-			strcat(tmp_cbfilename, "/share/qrq/callbase.qcb");
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
 
-			if (((fh = fopen(tmp_rcfilename, "r")) == NULL) ||
-				((fh = fopen(tmp_tlfilename, "r")) == NULL) ||
-				 ((fh = fopen(tmp_cbfilename, "r")) == NULL)) {
-				printw("Sorry: Couldn't find 'qrqrc', 'toplist' and"
-			   			" 'callbase.qcb' anywhere. Exit.\n");
-				getch();
-				endwin();
-				exit(EXIT_FAILURE);
-			}
-			else {			/* finally found it in DESTDIR/share/qrq/ ! */
-				/* abusing rcfilename here for something else temporarily */
-				printw("Found files in %s/share/qrq/."
-						"\nCreating directory %s/.qrq/ and copy qrqrc and"
-						" toplist there.\n", destdir, homedir);
-				strcpy(rcfilename, homedir);
-				strcat(rcfilename, "/.qrq/");
-#ifdef WIN32
-				j = mkdir(rcfilename);
-#else
-				j = mkdir(rcfilename,  0777);
-#endif
-				if (j && (errno != EEXIST)) {
-					printw("Failed to create %s! Exit.\n", rcfilename);
-					getch();
-					endwin();
-					exit(EXIT_FAILURE);
-				}
-				/* OK, now we created the directory, we can read in
-				 * DESTDIR/local/, so I assume copying files won't cause any
-				 * problem, with system()... */
+/* rng_seed seeds both random number generators, using splitmix64 to fill
+ * the state */
 
-				strcpy(rcfilename, "install -m 644 ");
-				strcat(rcfilename, tmp_tlfilename);
-				strcat(rcfilename, " ");
-				strcat(rcfilename, homedir);
-				strcat(rcfilename, "/.qrq/ 2> /dev/null");
-				if (system(rcfilename)) {
-					printw("Failed to copy toplist file: %s\n", rcfilename);
-					getch();
-					endwin();
-					exit(EXIT_FAILURE);
-				}
-				strcpy(rcfilename, "install -m 644 ");
-				strcat(rcfilename, tmp_rcfilename);
-				strcat(rcfilename, " ");
-				strcat(rcfilename, homedir);
-				strcat(rcfilename, "/.qrq/ 2> /dev/null");
-				if (system(rcfilename)) {
-					printw("Failed to copy qrqrc file: %s\n", rcfilename);
-					getch();
-					endwin();
-					exit(EXIT_FAILURE);
-				}
-				printw("Files copied. You might want to edit "
-						"qrqrc according to your needs.\n", homedir);
-				strcpy(rcfilename, homedir);
-				strcat(rcfilename, "/.qrq/qrqrc");
-				strcpy(tlfilename, homedir);
-				strcat(tlfilename, "/.qrq/toplist");
-				strcpy(cbfilename, tmp_cbfilename);
-			} /* found in DESTDIR/share/qrq/ */
+static void rng_seed (uint64_t seed) {
+	struct rng chan;
+	int i;
+	uint64_t z;
+
+	for (i = 0; i < 8; i++) {
+		z = splitmix64(&seed);
+		if (i < 4) {
+			rng_main.s[i] = z;
 		}
 		else {
-			printw("... found files in %s/.qrq/.\n", homedir);
-			strcat(tlfilename, homedir);
-			strcat(tlfilename, "/.qrq/toplist");
-			strcpy(cbfilename, destdir);
-			strcat(cbfilename, "/share/qrq/callbase.qcb");
+			chan.s[i-4] = z;
 		}
 	}
+
+	/* rng_chan belongs to the CW output: wait until it's done, the
+	 * continuous stream (which never stops) takes it over itself */
+	wait_cw();
+#ifndef WIN_THREADS
+	pthread_mutex_lock(&streamlock);
+	if (stream_running) {
+		rng_chan_next = chan;
+		rng_chan_pending = 1;
+	}
 	else {
-		printw("... found in current directory.\n");
-		strcpy(rcfilename, "qrqrc");
-		strcpy(tlfilename, "toplist");
-		strcpy(cbfilename, "callbase.qcb");
+		rng_chan = chan;
 	}
-	refresh();
-	fclose(fh);
-	return 0;
+	pthread_mutex_unlock(&streamlock);
+#else
+	rng_chan = chan;
+#endif
 }
 
+/* rng_next: xoshiro256** by D. Blackman and S. Vigna */
+
+static uint64_t rng_next (struct rng *r) {
+	uint64_t *s = r->s;
+	uint64_t result = s[1] * 5;
+	uint64_t t = s[1] << 17;
+
+	result = ((result << 7) | (result >> 57)) * 9;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = (s[3] << 45) | (s[3] >> 19);
+	return result;
+}
 
-static int statistics () {
-		char line[80]="";
+/* rng_double returns a random number in [0, 1) */
 
-		int time = 0;
-		int score = 0;
-		int count= 0;
+static double rng_double (struct rng *r) {
+	return (rng_next(r) >> 11) * (1.0/9007199254740992.0);
+}
 
-		FILE *fh;
-		FILE *fh2;
-		
-		if ((fh = fopen(tlfilename, "r")) == NULL) {
-				fprintf(stderr, "Unable to open toplist.");
-				exit(0);
-		}
-		
-		if ((fh2 = fopen("/tmp/qrq-plot", "w+")) == NULL) {
-				fprintf(stderr, "Unable to open /tmp/qrq-plot.");
-				exit(0);
-		}
-
-		fprintf(fh2, "set yrange [0:]\nset xlabel \"Date/Time\"\n"
-					"set title \"QRQ scores for %s. Press 'q' to "
-					"close this window.\"\n"
-					"set ylabel \"Score\"\nset xdata time\nset "
-					" timefmt \"%%s\"\n "
-					"plot \"-\" using 1:2 title \"\"\n", mycall);
-
-		while ((feof(fh) == 0) && (fgets(line, 80, fh) != NULL)) {
-				if ((strstr(line, mycall) != NULL)) {
-					count++;
-					sscanf(line, "%*s %d %*d %d", &score, &time);
-					fprintf(fh2, "%d %d\n", time, score);
-				}
-		}
+/* rng_below returns a random number in [0, n), without modulo bias
+ * (Lemire's multiply and reject) */
 
-		if (!count) {
-			fprintf(fh2, "0 0\n");
+static uint32_t rng_below (struct rng *r, uint32_t n) {
+	uint64_t m = (rng_next(r) >> 32) * n;
+	uint32_t t;
+
+	if ((uint32_t) m < n) {
+		t = -n % n;
+		while ((uint32_t) m < t) {
+			m = (rng_next(r) >> 32) * n;
 		}
-		
-		fprintf(fh2, "end\npause 10000");
+	}
+	return (uint32_t) (m >> 32);
+}
 
-		fclose(fh);
-		fclose(fh2);
+/* morse_units returns the length of 'text' in dot units, including the
+ * character space after every character */
 
-		system("gnuplot /tmp/qrq-plot 2> /dev/null &");
-	return 0;
+static int morse_units (const char *text) {
+	const char *code;
+	int units = 0;
+
+	for (; *text; text++) {
+		if ((code = morse_code(*text)) == NULL) {
+			code = "..--..";
+		}
+		for (; *code; code++) {
+			units += (*code == '.' ? 2 : 4);	/* element + gap */
+		}
+		units += 2;
+	}
+	return units;
 }
 
+/* compile_callbase converts the callbase 'in' to the .qcbx file 'out' */
 
-int read_callbase () {
+static int compile_callbase (char *in, char *out) {
 	FILE *fh;
-	int c,i;
-	int maxlen=0;
-	char tmp[80] = "";
-	int nr=0;
-
-	if ((fh = fopen(cbfilename, "r")) == NULL) {
-		endwin();
-		fprintf(stderr, "Error: Couldn't read callsign database ('%s')!\n",
-						cbfilename);
-		exit(EXIT_FAILURE);
+	struct qcbx_header h;
+	uint32_t off;
+	int i, nr;
+
+	strncpy(cbfilename, in, PATH_MAX - 1);
+	if ((nr = read_callbase()) < 0) {
+		fprintf(stderr, "%s\n", cberror);
+		return EXIT_FAILURE;
 	}
 
-	/* count the lines/calls and lengths */
-	i=0;
-	while ((c = getc(fh)) != EOF) {
-		i++;
-		if (c == '\n') {
-			nr++;
-			maxlen = (i > maxlen) ? i : maxlen;
-			i = 0;
-		}
+	if ((fh = fopen(out, "wb")) == NULL) {
+		fprintf(stderr, "Error: Couldn't write '%s'!\n", out);
+		return EXIT_FAILURE;
 	}
-	maxlen++;
 
-	if (!nr) {
-		endwin();
-		printf("\nError: Callsign database empty, no calls read. Exiting.\n");
-		exit(EXIT_FAILURE);
+	memcpy(h.magic, QCBX_MAGIC, 4);
+	h.version = QCBX_VERSION;
+	h.nr = nr;
+	h.strsize = 0;
+	for (i = 0; i < nr; i++) {
+		h.strsize += strlen(cb_call(i)) + 1;
 	}
+	fwrite(&h, sizeof(h), 1, fh);
 
-	/* allocate memory for calls array, free if needed */
-
-	free(calls);
-
-	if ((calls = (char **) malloc( (size_t) sizeof(char *)*nr )) == NULL) {
-		fprintf(stderr, "Error: Couldn't allocate %d bytes!\n", 
-						(int) sizeof(char)*nr);
-		exit(EXIT_FAILURE);
+	/* offsets in the new string area, which has no \r or cut-off rests */
+	for (off = 0, i = 0; i < nr; i++) {
+		fwrite(&off, sizeof(off), 1, fh);
+		off += strlen(cb_call(i)) + 1;
 	}
-	
-	/* Allocate each element of the array with size maxlen */
-	for (c=0; c < nr; c++) {
-		if ((calls[c] = (char *) malloc (maxlen * sizeof(char))) == NULL) {
-			fprintf(stderr, "Error: Couldn't allocate %d bytes!\n", maxlen);
-			exit(EXIT_FAILURE);
-		}
+	for (i = 0; i < nr; i++) {
+		fwrite(cb_call(i), strlen(cb_call(i)) + 1, 1, fh);
 	}
 
-	rewind(fh);
-	
-	nr=0;
-	while (fgets(tmp,maxlen,fh) != NULL) {
-		for (i = 0; i < strlen(tmp); i++) {
-				tmp[i] = toupper(tmp[i]);
-		}
-		tmp[i-1]='\0';				/* remove newline */
-		if (tmp[i-2] == '\r') {		/* also for DOS files */
-			tmp[i-2] = '\0';
-		}
-		strcpy(calls[nr],tmp);
-		nr++;
-		if (nr == c) 			/* may happen if call file corrupted */
-				break;
+	if (fclose(fh)) {
+		fprintf(stderr, "Error: Couldn't write '%s'!\n", out);
+		return EXIT_FAILURE;
 	}
-	fclose(fh);
-
+	printf("%s: %d calls\n", out, nr);
+	return 0;
+}
 
-	return nr;
+/* output frequency for the next call: a) random b) fixed */
 
+static int call_freq () {
+	if ( constanttone == 0 ) {
+			/* random freq, fraction of samplerate */
+			return (int) (samplerate/(50+(40.0*rng_double(&rng_main))));
+	}
+	else { /* fixed frequency */
+			return ctonefreq;
+	}
 }
 
 void find_callbases () {
 	DIR *dir;
 	struct dirent *dp;
+	struct stat st;
 	char tmp[PATH_MAX];
 	char path[3][PATH_MAX];
-	int i=0,j=0,k=0;
+	int i=0,k=0,changed=0;
 
 #ifndef WIN32
 		strcpy(path[0], getenv("PWD"));
@@ -1987,9 +6288,24 @@ void find_callbases () {
 		strcpy(path[2], "c:\\");
 #endif
 
-	for (i=0; i < 100; i++) {
-		strcpy(cblist[i], "");
+	/* nothing added or removed since the last time? */
+	for (k = 0; k < 3; k++) {
+		if (stat(path[k], &st)) {
+			st.st_mtime = 0;
+		}
+		if (st.st_mtime != cbdirmtime[k]) {
+			cbdirmtime[k] = st.st_mtime;
+			changed = 1;
+		}
+	}
+	if (cblistnr && !changed) {
+		return;
+	}
+
+	for (i = 0; i < cblistnr; i++) {
+		free(cblist[i].path);
 	}
+	cblistnr = 0;
 
 	/* foreach paths...  */
 	for (k = 0; k < 3; k++) {
@@ -1999,32 +6315,182 @@ void find_callbases () {
 		}
 	
 		while ((dp = readdir(dir))) {
-			strcpy(tmp, dp->d_name);
-			i = strlen(tmp);
-			/* find *.qcb files ...  */
-			if (i>4 && tmp[i-1] == 'b' && tmp[i-2] == 'c' && tmp[i-3] == 'q') {
-				strcpy(cblist[j], path[k]);
-				strcat(cblist[j], tmp);
-				j++;
+			i = strlen(dp->d_name);
+			/* find *.qcb and *.qcbx files ...  */
+			if (((i>4 && !strcmp(dp->d_name+i-4, ".qcb")) || 
+					(i>5 && !strcmp(dp->d_name+i-5, ".qcbx"))) &&
+					strlen(path[k]) + i < PATH_MAX) {
+				strcpy(tmp, path[k]);
+				strcat(tmp, dp->d_name);
+				add_callbase(tmp, -1, 0, -1);
 			}
 		}
+		closedir(dir);
 	} /* for paths */
+
+	add_callbase(GENCALLBASE, 0, 0, -1);
+	read_cbcache();
+}
+
+/* add_callbase adds a file to cblist */
+
+static void add_callbase (const char *path, long size, time_t mtime, long nr) {
+	if (cblistnr == cblistmax) {
+		cblistmax = cblistmax ? 2 * cblistmax : 64;
+		if ((cblist = realloc(cblist, cblistmax * sizeof(struct cbentry)))
+						== NULL) {
+			fprintf(stderr, "Error: Couldn't allocate %d bytes!\n", 
+							(int) (cblistmax * sizeof(struct cbentry)));
+			exit(EXIT_FAILURE);
+		}
+	}
+	if ((cblist[cblistnr].path = strdup(path)) == NULL) {
+		fprintf(stderr, "Error: Couldn't allocate %d bytes!\n", 
+						(int) strlen(path) + 1);
+		exit(EXIT_FAILURE);
+	}
+	cblist[cblistnr].size = size;
+	cblist[cblistnr].mtime = mtime;
+	cblist[cblistnr].nr = nr;
+	cblistnr++;
+}
+
+/* check_callbase counts the calls of a cblist entry, unless the cached
+ * number is still right (same size and mtime) */
+
+static void check_callbase (struct cbentry *e) {
+	struct stat st;
+
+	if (!strcmp(e->path, GENCALLBASE) || stat(e->path, &st)) {
+		return;
+	}
+	if (e->nr >= 0 && e->size == st.st_size && e->mtime == st.st_mtime) {
+		return;
+	}
+	e->size = st.st_size;
+	e->mtime = st.st_mtime;
+	e->nr = count_calls(e->path);
+	cbcachedirty = 1;
+}
+
+/* count_calls returns the number of calls in a callbase file (lines, or
+ * the number in the header of a .qcbx file), -1 if it can't be read */
+
+static long count_calls (const char *path) {
+	FILE *fh;
+	struct qcbx_header h;
+	char buf[65536], last = '\n';
+	long nr = 0;
+	size_t len, i;
+
+	if ((fh = fopen(path, "rb")) == NULL) {
+		return -1;
+	}
+	if (fread(&h, sizeof(h), 1, fh) == 1 && !memcmp(h.magic, QCBX_MAGIC, 4)) {
+		fclose(fh);
+		return h.nr;
+	}
+	rewind(fh);
+	while ((len = fread(buf, 1, sizeof(buf), fh)) > 0) {
+		for (i = 0; i < len; i++) {
+			nr += (buf[i] == '\n');
+		}
+		last = buf[len-1];
+	}
+	fclose(fh);
+	return nr + (last != '\n');
+}
+
+/* home_file returns the name of the file 'name' in ~/.qrq/ (like the
+ * callbase catalog cache), or NULL */
+
+static char *home_file (const char *name) {
+	static char path[PATH_MAX];
+	const char *home;
+
+#ifndef WIN32
+	home = getenv("HOME");
+	if (!home || strlen(home) + strlen(name) + 8 > PATH_MAX) {
+		return NULL;
+	}
+	strcpy(path, home);
+	strcat(path, "/.qrq/");
+#else
+	home = getenv("APPDATA");
+	if (!home || strlen(home) + strlen(name) + 8 > PATH_MAX) {
+		return NULL;
+	}
+	strcpy(path, home);
+	strcat(path, "/qrq/");
+#endif
+	strcat(path, name);
+	return path;
+}
+
+/* read_cbcache takes the sizes, mtimes and numbers of calls from the cache
+ * for all files in cblist. Lines: nr size mtime path */
+
+static void read_cbcache () {
+	FILE *fh;
+	char line[PATH_MAX + 64], *path;
+	long nr, size, mtime;
+	int i, n;
+
+	if (!home_file("callbases") || (fh = fopen(home_file("callbases"), "r")) == NULL) {
+		return;
+	}
+	while (fgets(line, sizeof(line), fh) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '#' || sscanf(line, "%ld %ld %ld %n", 
+								&nr, &size, &mtime, &n) != 3) {
+			continue;
+		}
+		path = line + n;
+		for (i = 0; i < cblistnr; i++) {
+			if (!strcmp(cblist[i].path, path)) {
+				cblist[i].nr = nr;
+				cblist[i].size = size;
+				cblist[i].mtime = (time_t) mtime;
+				break;
+			}
+		}
+	}
+	fclose(fh);
+}
+
+/* write_cbcache saves the known numbers of calls in the cache */
+
+static void write_cbcache () {
+	FILE *fh;
+	char tmpname[PATH_MAX+16];
+	int i;
+
+	if (!cbcachedirty || !home_file("callbases") || 
+					(fh = open_replace(home_file("callbases"), tmpname)) == NULL) {
+		return;
+	}
+	fprintf(fh, "# qrq callbase catalog: calls, size, mtime, file\n");
+	for (i = 0; i < cblistnr; i++) {
+		if (cblist[i].nr >= 0) {
+			fprintf(fh, "%ld %ld %ld %s\n", cblist[i].nr, cblist[i].size,
+							(long) cblist[i].mtime, cblist[i].path);
+		}
+	}
+	commit_replace(fh, tmpname, home_file("callbases"));
+	cbcachedirty = 0;
 }
 
 
 
 void select_callbase () {
-	int i = 0, j = 0, k = 0;
+	int i = cblistnr, j = 0, k = 0;
 	int c = 0;		/* cursor position   */
 	int p = 0;		/* page a 10 entries */
-	char* cblist_ptr;
+	char *name;
 
 
 	curs_set(FALSE);
 
-	/* count files */
-	while (strcmp(cblist[i], "")) i++;
-
 	if (!i) {
 		mvwprintw(conf_w,10,4, "No qcb-files found!");
 		wrefresh(conf_w);
@@ -2041,19 +6507,27 @@ void select_callbase () {
 
 	/* cls */
 	for (j = 5; j < 16; j++) {
-			mvwprintw(conf_w,j,2, "                                         ");
+			mvwprintw(conf_w,j,2, "                                "
+							"                        ");
 	}
 
-	/* display 10 files, highlight cursor position */
-	for (j = p*10; j < (p+1)*10; j++) {
-		if (j <= i) {
-				cblist_ptr = cblist[j];
-				mvwprintw(conf_w,5+(j - p*10 ),2, "  %s       ", cblist_ptr);
+	/* display 10 files with their number of calls, highlight cursor
+	 * position. Long paths are cut at the front. */
+	for (j = p*10; j < (p+1)*10 && j < i; j++) {
+		check_callbase(&cblist[j]);
+		name = cblist[j].path;
+		if (strlen(name) > 42) {
+			name += strlen(name) - 42;
+		}
+		mvwprintw(conf_w,5+(j - p*10 ),2, "  %-42s", name);
+		if (cblist[j].nr >= 0) {
+			mvwprintw(conf_w,5+(j - p*10 ),46, "%9ld", cblist[j].nr);
 		}
 		if (c == j) {						/* cursor */
 			mvwprintw(conf_w,5+(j - p*10),2, ">");
 		}
 	}
+	write_cbcache();
 	
 	wrefresh(conf_w);
 
@@ -2073,8 +6547,9 @@ void select_callbase () {
 			}
 			break;
 		case '\n':
-			strcpy(cbfilename, cblist[c]);
-			nrofcalls = read_callbase();
+			wait_callbase(0);
+			strcpy(cbfilename, cblist[c].path);
+			start_callbase();
 			return;	
 			break;
 	}
@@ -2098,7 +6573,22 @@ void help () {
 						" redistribute it\n");
 		printf("under certain conditions (see COPYING).\n\n");
 		printf("Start 'qrq' without any command line arguments for normal"
-					" operation.\n");
+					" operation.\n\n");
+		printf("  qrq --text FILE     Send FILE as continuous CW with the "
+					"speed from qrqrc\n");
+		printf("  qrq --seed N        Use the seed N for the attempts\n");
+		printf("  qrq --replay FILE   Run the attempt in a replay file again "
+					"(benchmark)\n");
+		printf("  qrq --compile-callbase IN.qcb OUT.qcbx\n"
+			   "                      Convert a callbase to the faster "
+					"binary format\n");
+		printf("  qrq --query chars|speed|slow [FILE...]\n"
+			   "                      Statistics from the session log\n");
+		printf("  qrq --save-config   Write qrqrc again with the current "
+					"settings (as F2)\n");
+		printf("  qrq --merge-toplist FILE...\n"
+			   "                      Merge toplist files (e.g. from the "
+					"internet) into the toplist\n");
 		exit(0);
 }
 